@@ -0,0 +1,136 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "events.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+/**
+ * Encoder acceleration engine, shared by input backends.
+ * Turns raw encoder deltas into accelerated ones based on the time between detents,
+ * which is only precise where events are read, so this must run in the reactor thread.
+ *
+ * Curves can be changed from any thread, everything else is meant for the reactor thread only.
+ */
+struct EncoderAccelerator {
+    EncoderAccelerator(const uint8_t numEncoders_)
+        : numEncoders(numEncoders_),
+          curves(new std::atomic<uint64_t>[numEncoders_]()),
+          states(numEncoders_, State {}) {}
+
+    /**
+     * Set the acceleration curve for encoder @a index, can be called from any thread.
+     */
+    void setCurve(const uint8_t index, const EncoderAcceleration& accel) noexcept
+    {
+        if (index >= numEncoders)
+            return;
+
+        curves[index].store(pack(accel), std::memory_order_relaxed);
+    }
+
+    /**
+     * Reset timing state, so the next detent of every encoder is not accelerated.
+     */
+    void reset() noexcept
+    {
+        for (State& state : states)
+            state = {};
+    }
+
+    /**
+     * Get the accelerated value for a @a delta rotation of encoder @a index happening at @a time.
+     * @a time must be in monotonic microseconds, as used for event timestamps.
+     * Never returns 0 for a non-zero @a delta.
+     */
+    int32_t apply(const uint8_t index, const int32_t delta, const uint64_t time) noexcept
+    {
+        if (index >= numEncoders || delta == 0)
+            return delta;
+
+        State& state = states[index];
+        const int8_t direction = delta > 0 ? 1 : -1;
+        // changing direction starts over from slow speed
+        const uint64_t last = state.direction == direction ? state.time : 0;
+        state.time = time;
+        state.direction = direction;
+
+        const uint64_t curve = curves[index].load(std::memory_order_relaxed);
+        const uint32_t slowTime = (curve >> 48) * 1000;
+
+        if (slowTime == 0)
+            return delta;
+
+        // leftovers of the other direction would eat into this rotation
+        if ((state.remainder ^ delta) < 0)
+            state.remainder = 0;
+
+        uint32_t multiplier = kFixedOne;
+
+        if (last != 0 && time > last)
+        {
+            const uint32_t fastTime = ((curve >> 32) & 0xffff) * 1000;
+            const uint64_t interval = (time - last) / (delta < 0 ? -delta : delta);
+
+            if (interval <= fastTime)
+            {
+                multiplier = (curve >> 16) & 0xffff;
+            }
+            else if (interval < slowTime && fastTime < slowTime)
+            {
+                const float maxMultiplier = static_cast<float>((curve >> 16) & 0xffff) / kFixedOne;
+                const float exponent = static_cast<float>(curve & 0xffff) / kFixedOne;
+                const float speed = static_cast<float>(slowTime - interval) / (slowTime - fastTime);
+
+                multiplier = (1.f + (maxMultiplier - 1.f) * std::pow(speed, exponent)) * kFixedOne;
+            }
+        }
+        else if (last != 0)
+        {
+            // same timestamp, as fast as it gets
+            multiplier = (curve >> 16) & 0xffff;
+        }
+
+        const int64_t value = state.remainder + static_cast<int64_t>(delta) * multiplier;
+        const int32_t result = value / kFixedOne;
+
+        state.remainder = value - static_cast<int64_t>(result) * kFixedOne;
+        return result;
+    }
+
+private:
+    // multipliers and exponents are stored as 8.8 fixed point
+    static constexpr const uint32_t kFixedOne = 256;
+
+    struct State {
+        // time of last detent
+        uint64_t time;
+        // fractional part of the last accelerated value, in fixed point
+        int32_t remainder;
+        // direction of last detent, 1 or -1, 0 if none yet
+        int8_t direction;
+    };
+
+    const uint8_t numEncoders;
+    // packed curves, see pack()
+    std::unique_ptr<std::atomic<uint64_t>[]> curves;
+    std::vector<State> states;
+
+    // pack a curve into a single word, so it can be updated atomically:
+    // slowTime (16 bits), fastTime (16 bits), maxMultiplier (8.8), exponent (8.8)
+    static uint64_t pack(const EncoderAcceleration& accel) noexcept
+    {
+        const float maxMultiplier = accel.maxMultiplier < 1.f ? 1.f : accel.maxMultiplier > 255.f ? 255.f : accel.maxMultiplier;
+        const float exponent = accel.exponent < 0.f ? 0.f : accel.exponent > 255.f ? 255.f : accel.exponent;
+
+        return static_cast<uint64_t>(accel.slowTime) << 48
+             | static_cast<uint64_t>(accel.fastTime) << 32
+             | static_cast<uint64_t>(maxMultiplier * kFixedOne) << 16
+             | static_cast<uint64_t>(exponent * kFixedOne);
+    }
+};
@@ -0,0 +1,173 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "events.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Runtime actuator state table, shared by input backends.
+ * Encoders come first, followed by footswitches; a "slot" is the position within the table.
+ *
+ * Data is stored as structure-of-arrays inside a single allocation done on construction,
+ * so the per-event paths never allocate and scans over a single field stay within few cache lines.
+ * Everything except the tap-tempo flags is meant to be accessed by the reactor thread only.
+ */
+struct ActuatorTable {
+    const uint8_t numEncoders;
+    const uint8_t numFootswitches;
+    const uint16_t count;
+
+    /** time of last press in monotonic microseconds, 0 if not pressed. */
+    uint64_t* pressTime;
+
+    /** time of last tap in monotonic microseconds. */
+    uint64_t* tapTime;
+
+    /** current tap-tempo period in microseconds. */
+    uint32_t* tapValue;
+
+    /** current actuator state. */
+    EventState* state;
+
+    /** whether tap-tempo is enabled, written by the poll thread. */
+    std::atomic<bool>* tapEnabled;
+
+    /** request for the reactor thread to reset tap-tempo, written by the poll thread. */
+    std::atomic<bool>* tapReset;
+
+    ActuatorTable(const EventActuators& actuators)
+        : numEncoders(actuators.numEncoders),
+          numFootswitches(actuators.numFootswitches),
+          count(actuators.numEncoders + actuators.numFootswitches)
+    {
+        // sorted by alignment, so each array starts properly aligned
+        const size_t size = count * (sizeof(uint64_t) * 2
+                                   + sizeof(uint32_t)
+                                   + sizeof(EventState)
+                                   + sizeof(std::atomic<bool>) * 2);
+
+        uint8_t* ptr = static_cast<uint8_t*>(std::calloc(1, size != 0 ? size : 1));
+        data = ptr;
+
+        pressTime = reinterpret_cast<uint64_t*>(ptr);
+        ptr += sizeof(uint64_t) * count;
+
+        tapTime = reinterpret_cast<uint64_t*>(ptr);
+        ptr += sizeof(uint64_t) * count;
+
+        tapValue = reinterpret_cast<uint32_t*>(ptr);
+        ptr += sizeof(uint32_t) * count;
+
+        state = reinterpret_cast<EventState*>(ptr);
+        ptr += sizeof(EventState) * count;
+
+        tapEnabled = reinterpret_cast<std::atomic<bool>*>(ptr);
+        ptr += sizeof(std::atomic<bool>) * count;
+
+        tapReset = reinterpret_cast<std::atomic<bool>*>(ptr);
+
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            state[i] = kEventStateReleased;
+            new (&tapEnabled[i]) std::atomic<bool>(false);
+            new (&tapReset[i]) std::atomic<bool>(false);
+        }
+    }
+
+    ~ActuatorTable()
+    {
+        std::free(data);
+    }
+
+    /** Get the slot for an actuator, or -1 if out of range. */
+    int slot(const EventType etype, const uint8_t index) const noexcept
+    {
+        switch (etype)
+        {
+        case kEventTypeEncoder:
+            return index < numEncoders ? index : -1;
+        case kEventTypeFootswitch:
+            return index < numFootswitches ? numEncoders + index : -1;
+        case kEventTypeNull:
+        case kEventTypeLED:
+            break;
+        }
+        return -1;
+    }
+
+    /** Get the actuator type of a slot. */
+    EventType typeAt(const uint16_t slot) const noexcept
+    {
+        return slot < numEncoders ? kEventTypeEncoder : kEventTypeFootswitch;
+    }
+
+    /** Get the actuator index of a slot. */
+    uint8_t indexAt(const uint16_t slot) const noexcept
+    {
+        return slot < numEncoders ? slot : slot - numEncoders;
+    }
+
+    /** Reset all live state, including disabling tap-tempo. */
+    void reset() noexcept
+    {
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            pressTime[i] = 0;
+            tapTime[i] = 0;
+            tapValue[i] = 0;
+            state[i] = kEventStateReleased;
+            tapEnabled[i].store(false, std::memory_order_relaxed);
+            tapReset[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Register a tap at @a timeUs for tap-tempo calculation.
+     * Returns true if the tap-tempo value in tapValue was updated.
+     */
+    bool updateTapTempo(const uint16_t slot, const uint64_t timeUs) noexcept
+    {
+        if (tapReset[slot].exchange(false, std::memory_order_acquire))
+        {
+            tapTime[slot] = 0;
+            tapValue[slot] = 0;
+        }
+
+        const uint64_t last = tapTime[slot];
+        tapTime[slot] = timeUs;
+
+        if (last == 0 || timeUs <= last)
+            return false;
+
+        uint32_t delta = timeUs - last;
+
+        if (delta > EVENT_BRIDGE_TAP_TEMPO_TIMEOUT * 1000)
+        {
+            if (delta - EVENT_BRIDGE_TAP_TEMPO_TIMEOUT_OVERFLOW * 1000 > EVENT_BRIDGE_TAP_TEMPO_TIMEOUT * 1000)
+                return false;
+
+            delta = EVENT_BRIDGE_TAP_TEMPO_TIMEOUT * 1000;
+        }
+
+        const uint32_t value = tapValue[slot];
+
+        // running average only once we have a previous value to average against
+        if (value != 0 && (value > delta ? value - delta : delta - value) < EVENT_BRIDGE_TAP_TEMPO_HYSTERESIS * 1000)
+            tapValue[slot] = (value * 2 + delta) / 3;
+        else
+            tapValue[slot] = delta;
+
+        return true;
+    }
+
+private:
+    void* data;
+
+    ActuatorTable(const ActuatorTable&) = delete;
+    ActuatorTable& operator=(const ActuatorTable&) = delete;
+};
@@ -0,0 +1,181 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+// Throughput and latency benchmark, feeding synthetic events through EventBridge.
+// Usage: event-bridge-benchmark [-t seconds] [-c capture-file] [-r replay-options] [synthetic-options...]
+// Each synthetic-options argument adds one synthetic input, see events-synthetic.cpp for the accepted options.
+// Each -r argument adds one replay input for benchmarking with captured traces, see events-replay.cpp.
+// Received events can be captured with -c, for creating traces or verifying replays.
+
+#include "event-bridge.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <poll.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#define BENCHMARK_DEFAULT_OPTIONS "count=1000000"
+#define BENCHMARK_DEFAULT_SECONDS 10
+// stop once no events arrive for this long, in microseconds, when the expected amount of events is unknown
+#define BENCHMARK_IDLE_TIMEOUT 1000000
+
+// --------------------------------------------------------------------------------------------------------------------
+
+struct Benchmark : EventBridge::Callback {
+    // queue latency of each received event, in microseconds
+    std::vector<uint32_t> latencies;
+
+    void eventReceived(EventType, EventState, uint8_t, int32_t, const uint64_t time) override
+    {
+        latencies.push_back(EventTimeUs() - time);
+    }
+
+    void eventsReceived(const Event* const events, const uint32_t count) override
+    {
+        const uint64_t now = EventTimeUs();
+
+        for (uint32_t i = 0; i < count; ++i)
+            latencies.push_back(now - events[i].time);
+    }
+};
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, const double p)
+{
+    if (sorted.empty())
+        return 0;
+
+    return sorted[std::min<size_t>(sorted.size() * p / 100.0, sorted.size() - 1)];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    uint32_t seconds = BENCHMARK_DEFAULT_SECONDS;
+    std::vector<const char*> inputs;
+    std::vector<const char*> replays;
+    const char* capture = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            seconds = std::strtoul(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            replays.push_back(argv[++i]);
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            capture = argv[++i];
+        else
+            inputs.push_back(argv[i]);
+    }
+
+    if (inputs.empty() && replays.empty())
+        inputs.push_back(BENCHMARK_DEFAULT_OPTIONS);
+
+    // expected amount of events, 0 if any input is unlimited or a replay
+    uint64_t expected = 0;
+
+    if (replays.empty())
+    {
+        for (const char* const options : inputs)
+        {
+            const char* const count = std::strstr(options, "count=");
+
+            if (count == nullptr || (expected += std::strtoul(count + 6, nullptr, 10)) == 0)
+            {
+                expected = 0;
+                break;
+            }
+        }
+    }
+
+    Benchmark benchmark;
+    benchmark.latencies.reserve(expected != 0 ? expected : 1000000);
+
+    EventBridge bridge(&benchmark);
+
+    if (capture != nullptr && ! bridge.startCapture(capture))
+    {
+        fprintf(stderr, "failed to start capture: %s\n", bridge.last_error.c_str());
+        return 1;
+    }
+
+    for (const char* const options : inputs)
+    {
+        if (! bridge.addInput(EventInput::kBackendTypeSynthetic, options))
+        {
+            fprintf(stderr, "failed to add synthetic input '%s': %s\n", options, bridge.last_error.c_str());
+            return 1;
+        }
+    }
+
+    for (const char* const options : replays)
+    {
+        if (! bridge.addInput(EventInput::kBackendTypeReplay, options))
+        {
+            fprintf(stderr, "failed to add replay input '%s': %s\n", options, bridge.last_error.c_str());
+            return 1;
+        }
+    }
+
+    struct pollfd pfd = { bridge.getPollFD(), POLLIN, 0 };
+
+    const uint64_t start = EventTimeUs();
+    const uint64_t end = start + static_cast<uint64_t>(seconds) * 1000000;
+    uint64_t pollTime = 0;
+    uint64_t lastReceived = start;
+
+    for (uint64_t now = start; now < end; now = EventTimeUs())
+    {
+        if (pfd.fd != -1)
+            ::poll(&pfd, 1, 100);
+
+        const size_t received = benchmark.latencies.size();
+
+        const uint64_t t = EventTimeUs();
+        bridge.poll();
+        pollTime += EventTimeUs() - t;
+
+        if (expected != 0)
+        {
+            if (benchmark.latencies.size() >= expected)
+                break;
+        }
+        else if (received != benchmark.latencies.size())
+        {
+            lastReceived = t;
+        }
+        else if (received != 0 && t - lastReceived > BENCHMARK_IDLE_TIMEOUT)
+        {
+            break;
+        }
+    }
+
+    const double elapsed = (EventTimeUs() - start) / 1000000.0;
+    const size_t received = benchmark.latencies.size();
+
+    std::vector<uint32_t>& sorted = benchmark.latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("inputs:      %zu\n", inputs.size() + replays.size());
+    printf("events:      %zu received", received);
+    if (expected != 0)
+        printf(", %llu lost", static_cast<unsigned long long>(expected - std::min<uint64_t>(expected, received)));
+    printf("\n");
+    printf("throughput:  %.0f events/s over %.3f s\n", received / elapsed, elapsed);
+    printf("cost:        %.1f ns/event in poll()\n", received != 0 ? pollTime * 1000.0 / received : 0.0);
+    printf("latency us:  p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n",
+           percentile(sorted, 50),
+           percentile(sorted, 90),
+           percentile(sorted, 99),
+           percentile(sorted, 99.9),
+           sorted.empty() ? 0 : sorted.back());
+
+    return received != 0 ? 0 : 1;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
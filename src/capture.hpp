@@ -0,0 +1,95 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "events.hpp"
+
+#include <cstring>
+
+/**
+ * Binary event capture format, as written by EventBridge::startCapture() and read by the replay input backend.
+ *
+ * A capture file is a single EventCaptureHeader followed by any number of EventCaptureRecord entries.
+ * Files are append-only, so several capture sessions can be written into the same file;
+ * timestamps are monotonic and thus only comparable within a single boot.
+ * All values are stored in host byte order.
+ */
+#define EVENT_CAPTURE_MAGIC "EBcp"
+#define EVENT_CAPTURE_VERSION 1
+
+struct EventCaptureHeader {
+    /** Always EVENT_CAPTURE_MAGIC. */
+    char magic[4];
+
+    /** Format version, currently EVENT_CAPTURE_VERSION. */
+    uint16_t version;
+
+    /** Size of each record in bytes, allows readers to skip fields added in later versions. */
+    uint16_t recordSize;
+};
+
+struct EventCaptureRecord {
+    /** Monotonic time in microseconds of when the event happened. */
+    uint64_t time;
+
+    /** Event value. */
+    int32_t value;
+
+    /** EventType. */
+    uint8_t etype;
+
+    /** EventState. */
+    uint8_t state;
+
+    /** Actuator index. */
+    uint8_t index;
+
+    /** Padding, always 0. */
+    uint8_t reserved;
+};
+
+static_assert(sizeof(EventCaptureHeader) == 8, "EventCaptureHeader must be packed");
+static_assert(sizeof(EventCaptureRecord) == 16, "EventCaptureRecord must be packed");
+
+/**
+ * Create a capture header for the current format version.
+ */
+static inline
+EventCaptureHeader EventCaptureHeaderInit() noexcept
+{
+    EventCaptureHeader header;
+    std::memcpy(header.magic, EVENT_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = EVENT_CAPTURE_VERSION;
+    header.recordSize = sizeof(EventCaptureRecord);
+    return header;
+}
+
+/**
+ * Check if a capture header is valid and readable by this version.
+ */
+static inline
+bool EventCaptureHeaderValid(const EventCaptureHeader& header) noexcept
+{
+    return std::memcmp(header.magic, EVENT_CAPTURE_MAGIC, sizeof(header.magic)) == 0
+        && header.version >= 1
+        && header.recordSize >= sizeof(EventCaptureRecord);
+}
+
+/**
+ * Convert an event into a capture record.
+ */
+static inline
+EventCaptureRecord EventCaptureRecordFromEvent(const Event& ev) noexcept
+{
+    return { ev.time, ev.value, static_cast<uint8_t>(ev.etype), static_cast<uint8_t>(ev.state), ev.index, 0 };
+}
+
+/**
+ * Convert a capture record back into an event.
+ */
+static inline
+Event EventCaptureRecordToEvent(const EventCaptureRecord& rec) noexcept
+{
+    return { static_cast<EventType>(rec.etype), static_cast<EventState>(rec.state), rec.index, rec.value, rec.time };
+}
@@ -2,10 +2,21 @@
 // SPDX-License-Identifier: ISC
 
 #include "event-bridge.hpp"
+#include "capture.hpp"
+#include "output-worker.hpp"
+#include "timerqueue.hpp"
 
-#include <unordered_map>
+#include <cerrno>
+#include <cstring>
 #include <vector>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 // --------------------------------------------------------------------------------------------------------------------
 
 static inline constexpr EventType event_type(const EventOutput::BackendType type) noexcept
@@ -16,6 +27,8 @@ static inline constexpr EventType event_type(const EventOutput::BackendType type
         return kEventTypeNull;
     case EventOutput::kBackendTypeGPIO:
     case EventOutput::kBackendTypeSysfsLED:
+    case EventOutput::kBackendTypeGPIOChip:
+    case EventOutput::kBackendTypeLibSerialPort:
         return kEventTypeLED;
     }
 
@@ -24,57 +37,305 @@ static inline constexpr EventType event_type(const EventOutput::BackendType type
 
 static inline constexpr uint32_t event_id(const EventType etype, const uint8_t index) noexcept
 {
-    return static_cast<uint32_t>(etype) * UINT8_MAX + index;
+    return static_cast<uint32_t>(etype) << 8 | index;
 }
 
+// total number of possible event ids, used for sizing the output dispatch table
+static constexpr const uint32_t kNumEventIds = event_id(kEventTypeLED, UINT8_MAX) + 1;
+
 // --------------------------------------------------------------------------------------------------------------------
 
-struct EventBridge::Impl : EventInput::Callback
+struct EventBridge::Impl : EventInput::Callback,
+                           EventReactor,
+                           EventReactor::Handler
 {
     EventBridge::Callback* const callback;
+    const EventActuators actuators;
     std::vector<EventInput*> inputs;
-    std::unordered_map<uint32_t, EventOutput*> outputs;
 
-    Impl(EventBridge::Callback* const callback_, std::string& last_error_)
+    // encoder coalescing window, applied to every new input
+    uint16_t encoderCoalesceTime = EVENT_BRIDGE_ENCODER_COALESCE_TIME;
+    // encoder acceleration curves, applied to every new input
+    std::vector<EncoderAcceleration> encoderAccelerations;
+
+    // events received during the current poll() cycle, delivered to the callback in one go
+    std::vector<Event> batch;
+
+    // all outputs, grouped by event id so that each id maps to a contiguous range
+    std::vector<OutputWorker::Slot*> outputs;
+    // flat dispatch table indexed by event id, offset + count into outputs
+    struct OutputRange {
+        uint16_t offset;
+        uint16_t count;
+    } dispatch[kNumEventIds] = {};
+
+    // thread doing the actual output writes, so sendEvent() never blocks on drivers
+    OutputWorker outputWorker;
+
+    // eventfd signaled by inputs when new events are ready, given to the host as poll FD
+    int notifyfd = -1;
+
+    // capture file opened in append mode, -1 when not capturing
+    int capturefd = -1;
+    // records of the current poll() cycle, written to the capture file in one go
+    std::vector<EventCaptureRecord> captureBuffer;
+
+    // reactor epoll FD, watching over all input FDs
+    int reactorfd = -1;
+    // eventfd used to wake up and stop the reactor thread
+    int stopfd = -1;
+    // deadlines armed by inputs, only accessed by the reactor thread
+    TimerQueue timers;
+
+    // registered input FDs, epoll data points to these
+    struct Registration {
+        int fd;
+        EventReactor::Handler* handler;
+    };
+    std::vector<Registration*> registrations;
+    // removed registrations, freed by the reactor thread once no longer referenced by pending epoll events
+    std::vector<Registration*> unregistered;
+    pthread_mutex_t registrationsLock = {};
+
+    struct {
+        pthread_t handle = {};
+        bool running = false;
+    } thread;
+
+    Impl(EventBridge::Callback* const callback_, const EventActuators& actuators_, std::string& last_error_)
         : callback(callback_),
-          last_error(last_error_) {}
+          actuators(actuators_),
+          last_error(last_error_)
+    {
+        batch.reserve(EVENT_BRIDGE_QUEUE_SIZE);
+        encoderAccelerations.resize(actuators.numEncoders);
+
+        pthread_mutex_init(&registrationsLock, nullptr);
+
+        notifyfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (notifyfd == -1)
+        {
+            last_error = "failed to create event fd: ";
+            last_error += std::strerror(errno);
+            return;
+        }
+
+        reactorfd = epoll_create1(EPOLL_CLOEXEC);
+        if (reactorfd == -1)
+        {
+            last_error = "failed to create epoll fd: ";
+            last_error += std::strerror(errno);
+            close();
+            return;
+        }
+
+        stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (stopfd == -1)
+        {
+            last_error = "failed to create event fd: ";
+            last_error += std::strerror(errno);
+            close();
+            return;
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(reactorfd, EPOLL_CTL_ADD, stopfd, &ev);
+
+        if (timers.getFD() == -1 || ! addFD(timers.getFD(), EPOLLIN, this))
+        {
+            last_error = "failed to create timer fd: ";
+            last_error += std::strerror(errno);
+            close();
+            return;
+        }
+
+        thread.running = true;
+        if (pthread_create(&thread.handle, nullptr, _run, this) != 0)
+        {
+            thread.running = false;
+            last_error = "failed to create reactor thread";
+            close();
+            return;
+        }
+    }
 
     ~Impl()
     {
+        // stop reading events before destroying inputs, so their handlers are never called mid-destruction
+        if (thread.running)
+        {
+            const uint64_t value = 1;
+            write(stopfd, &value, sizeof(value));
+            pthread_join(thread.handle, nullptr);
+            thread.running = false;
+        }
+
         for (EventInput* input : inputs)
             delete input;
 
-        for (auto& item : outputs)
-            delete item.second;
+        outputWorker.stop();
+
+        for (OutputWorker::Slot* slot : outputs)
+        {
+            delete slot->output;
+            delete slot;
+        }
+
+        for (Registration* reg : registrations)
+            delete reg;
+
+        for (Registration* reg : unregistered)
+            delete reg;
 
+        pthread_mutex_destroy(&registrationsLock);
+
+        stopCapture();
         close();
     }
 
     void close()
     {
+        if (stopfd != -1)
+        {
+            ::close(stopfd);
+            stopfd = -1;
+        }
+
+        if (reactorfd != -1)
+        {
+            ::close(reactorfd);
+            reactorfd = -1;
+        }
+
+        if (notifyfd != -1)
+        {
+            ::close(notifyfd);
+            notifyfd = -1;
+        }
     }
 
     bool addInput(const EventInput::BackendType type, const char* const id, const uint8_t index)
     {
-        if (EventInput* const input = EventInput::createNew(type, id, index))
+        if (! thread.running)
         {
+            last_error = "reactor is not running";
+            return false;
+        }
+
+        // given on creation, so they apply before the input registers itself on the reactor
+        EventEncoderSettings encoders;
+        encoders.coalesceTime = encoderCoalesceTime;
+        encoders.accelerations = encoderAccelerations.data();
+
+        if (EventInput* const input = EventInput::createNew(type, this, actuators, id, index, encoders))
+        {
+            input->notifyfd.store(notifyfd, std::memory_order_release);
             inputs.push_back(input);
+
+            // the input might have queued events before knowing where to signal them
+            input->notify();
             return true;
         }
 
+        last_error = "failed to create input";
         return false;
     }
 
+    // ----------------------------------------------------------------------------------------------------------------
+    // EventReactor
+
+    bool addFD(const int fd, const uint32_t events, EventReactor::Handler* const handler) override
+    {
+        Registration* const reg = new Registration { fd, handler };
+
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.ptr = reg;
+
+        if (epoll_ctl(reactorfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            delete reg;
+            return false;
+        }
+
+        pthread_mutex_lock(&registrationsLock);
+        registrations.push_back(reg);
+        pthread_mutex_unlock(&registrationsLock);
+        return true;
+    }
+
+    void removeFD(const int fd) override
+    {
+        epoll_ctl(reactorfd, EPOLL_CTL_DEL, fd, nullptr);
+
+        pthread_mutex_lock(&registrationsLock);
+
+        for (auto it = registrations.begin(); it != registrations.end(); ++it)
+        {
+            if ((*it)->fd == fd)
+            {
+                (*it)->handler = nullptr;
+                unregistered.push_back(*it);
+                registrations.erase(it);
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&registrationsLock);
+    }
+
+    void armTimer(EventReactor::Handler* const handler, const uint32_t id, const uint64_t deadline) override
+    {
+        timers.arm(handler, id, deadline);
+    }
+
+    void cancelTimer(EventReactor::Handler* const handler, const uint32_t id) override
+    {
+        timers.cancel(handler, id);
+    }
+
+    void cancelTimers(EventReactor::Handler* const handler) override
+    {
+        timers.cancelAll(handler);
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // EventReactor::Handler, for the timer queue
+
+    void fdReady(int, uint32_t) override
+    {
+        timers.process();
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+
     bool addOutput(const EventOutput::BackendType type, const char* const id, const uint8_t index)
     {
         const uint32_t idx = event_id(event_type(type), index);
 
+        if (outputs.size() == EVENT_BRIDGE_MAX_OUTPUTS)
+        {
+            last_error = "too many outputs";
+            return false;
+        }
+
         if (EventOutput* const output = EventOutput::createNew(type, id))
         {
-            outputs[idx] = output;
+            // keep outputs grouped by event id, shifting the ranges of all ids that come after this one
+            const uint16_t pos = dispatch[idx].offset + dispatch[idx].count;
+            outputs.insert(outputs.begin() + pos, new OutputWorker::Slot(output));
+
+            ++dispatch[idx].count;
+
+            for (uint32_t i = idx + 1; i < kNumEventIds; ++i)
+                ++dispatch[i].offset;
+
             return true;
         }
 
+        last_error = "failed to create output";
         return false;
     }
 
@@ -84,8 +345,11 @@ struct EventBridge::Impl : EventInput::Callback
             input->clear();
     }
 
-    void enableTapTempo(const EventType etype, uint8_t index, const bool enable)
+    void enableTapTempo(const EventType etype, const uint8_t index, const bool enable)
     {
+        // actuator slot, up to 255 encoders followed by up to 255 footswitches
+        uint16_t slot = index;
+
         switch (etype)
         {
         case kEventTypeNull:
@@ -93,28 +357,162 @@ struct EventBridge::Impl : EventInput::Callback
         case kEventTypeLED:
             break;
         case kEventTypeFootswitch:
-            index += NUM_ENCODERS;
+            slot += actuators.numEncoders;
             break;
         }
 
         for (EventInput* input : inputs)
-            input->enableTapTempo(index, enable);
+            input->enableTapTempo(slot, enable);
+    }
+
+    void setEncoderCoalesceTime(const uint16_t timeMs)
+    {
+        encoderCoalesceTime = timeMs;
+
+        for (EventInput* input : inputs)
+            input->setEncoderCoalesceTime(timeMs);
+    }
+
+    void setEncoderAcceleration(const uint8_t index, const EncoderAcceleration& accel)
+    {
+        if (index >= actuators.numEncoders)
+            return;
+
+        encoderAccelerations[index] = accel;
+
+        for (EventInput* input : inputs)
+            input->setEncoderAcceleration(index, accel);
     }
 
     void poll()
     {
+        // consume notifications before polling, so that events queued meanwhile trigger a new one
+        uint64_t count;
+
+        if (notifyfd != -1)
+            while (read(notifyfd, &count, sizeof(count)) == sizeof(count)) {}
+
+        batch.clear();
+
         for (EventInput* input : inputs)
             input->poll(this);
+
+        if (batch.empty())
+            return;
+
+        // keep LED effects in sync with tap-tempo
+        for (const Event& ev : batch)
+        {
+            if (ev.etype == kEventTypeFootswitch && ev.state == kEventStateTapTempo)
+                outputWorker.setTempo(ev.index, ev.value, ev.time);
+        }
+
+        if (capturefd != -1)
+            capture();
+
+        if (callback != nullptr)
+            callback->eventsReceived(batch.data(), batch.size());
+    }
+
+    bool startCapture(const char* const path)
+    {
+        stopCapture();
+
+        const int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1)
+        {
+            last_error = "failed to open capture file: ";
+            last_error += std::strerror(errno);
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            last_error = "failed to stat capture file: ";
+            last_error += std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+
+        if (st.st_size == 0)
+        {
+            const EventCaptureHeader header = EventCaptureHeaderInit();
+
+            if (write(fd, &header, sizeof(header)) != sizeof(header))
+            {
+                last_error = "failed to write capture file header";
+                ::close(fd);
+                return false;
+            }
+        }
+        else
+        {
+            // appending to an existing capture, which must be of the same format
+            EventCaptureHeader header = {};
+
+            if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+                || ! EventCaptureHeaderValid(header)
+                || header.version != EVENT_CAPTURE_VERSION
+                || header.recordSize != sizeof(EventCaptureRecord))
+            {
+                last_error = "existing file is not a compatible event capture";
+                ::close(fd);
+                return false;
+            }
+
+            // drop partially written record from an interrupted session, so new records stay aligned
+            const off_t partial = (st.st_size - sizeof(header)) % sizeof(EventCaptureRecord);
+
+            if (partial != 0 && ftruncate(fd, st.st_size - partial) != 0)
+            {
+                last_error = "failed to truncate capture file: ";
+                last_error += std::strerror(errno);
+                ::close(fd);
+                return false;
+            }
+        }
+
+        captureBuffer.reserve(EVENT_BRIDGE_QUEUE_SIZE);
+        capturefd = fd;
+        return true;
+    }
+
+    void stopCapture()
+    {
+        if (capturefd == -1)
+            return;
+
+        ::close(capturefd);
+        capturefd = -1;
     }
 
     bool sendEvent(const EventType etype, const uint8_t index, const int32_t value)
     {
         const uint32_t idx = event_id(etype, index);
 
-        for (auto& item : outputs)
+        if (idx >= kNumEventIds)
+            return false;
+
+        const OutputRange range = dispatch[idx];
+
+        for (uint16_t i = 0; i < range.count; ++i)
+            outputWorker.send(outputs[range.offset + i], value);
+
+        return true;
+    }
+
+    bool setLEDEffect(const uint8_t index, const LEDEffect& effect)
+    {
+        const OutputRange range = dispatch[event_id(kEventTypeLED, index)];
+
+        for (uint16_t i = 0; i < range.count; ++i)
         {
-            if (item.first == idx)
-                item.second->event(value);
+            if (! outputWorker.sendEffect(outputs[range.offset + i], effect))
+            {
+                last_error = "output worker is not running";
+                return false;
+            }
         }
 
         return true;
@@ -123,17 +521,99 @@ struct EventBridge::Impl : EventInput::Callback
 private:
     std::string& last_error;
 
-    void event(const EventType etype, const EventState state, const uint8_t index, const int32_t value) override
+    // append the current batch to the capture file with a single write
+    void capture()
     {
-        if (callback != nullptr)
-            callback->eventReceived(etype, state, index, value);
+        captureBuffer.clear();
+
+        for (const Event& ev : batch)
+            captureBuffer.push_back(EventCaptureRecordFromEvent(ev));
+
+        const size_t size = captureBuffer.size() * sizeof(EventCaptureRecord);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(captureBuffer.data());
+
+        for (size_t written = 0; written < size;)
+        {
+            const ssize_t ret = write(capturefd, data + written, size - written);
+
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                last_error = "failed to write capture file, capture stopped: ";
+                last_error += std::strerror(errno);
+                stopCapture();
+                return;
+            }
+
+            written += ret;
+        }
+    }
+
+    static void* _run(void* const arg)
+    {
+        static_cast<Impl*>(arg)->run();
+        return nullptr;
+    }
+
+    void run()
+    {
+        struct epoll_event evs[16];
+
+        for (;;)
+        {
+            const int count = epoll_wait(reactorfd, evs, sizeof(evs)/sizeof(evs[0]), -1);
+
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                // stop request
+                if (evs[i].data.ptr == nullptr)
+                    return;
+
+                const Registration* const reg = static_cast<const Registration*>(evs[i].data.ptr);
+
+                if (reg->handler != nullptr)
+                    reg->handler->fdReady(reg->fd, evs[i].events);
+            }
+
+            pthread_mutex_lock(&registrationsLock);
+
+            for (Registration* reg : unregistered)
+                delete reg;
+
+            unregistered.clear();
+
+            pthread_mutex_unlock(&registrationsLock);
+        }
+    }
+
+    void event(const EventType etype,
+               const EventState state,
+               const uint8_t index,
+               const int32_t value,
+               const uint64_t time) override
+    {
+        batch.push_back({ etype, state, index, value, time });
+    }
+
+    void events(const Event* const evs, const uint32_t count) override
+    {
+        batch.insert(batch.end(), evs, evs + count);
     }
 };
 
 // --------------------------------------------------------------------------------------------------------------------
 
-EventBridge::EventBridge(Callback* const callback)
-    : impl(new Impl(callback, last_error)) {}
+EventBridge::EventBridge(Callback* const callback, const EventActuators& actuators)
+    : impl(new Impl(callback, actuators, last_error)) {}
 
 EventBridge::~EventBridge() { delete impl; }
 
@@ -147,6 +627,11 @@ bool EventBridge::addOutput(const EventOutput::BackendType type, const char* con
     return impl->addOutput(type, id, index);
 }
 
+const EventActuators& EventBridge::getActuators() const noexcept
+{
+    return impl->actuators;
+}
+
 void EventBridge::clear()
 {
     impl->clear();
@@ -157,14 +642,44 @@ void EventBridge::enableTapTempo(const EventType etype, const uint8_t index, con
     impl->enableTapTempo(etype, index, enable);
 }
 
+void EventBridge::setEncoderCoalesceTime(const uint16_t timeMs)
+{
+    impl->setEncoderCoalesceTime(timeMs);
+}
+
+void EventBridge::setEncoderAcceleration(const uint8_t index, const EncoderAcceleration& accel)
+{
+    impl->setEncoderAcceleration(index, accel);
+}
+
+int EventBridge::getPollFD() const noexcept
+{
+    return impl->notifyfd;
+}
+
 void EventBridge::poll()
 {
     impl->poll();
 }
 
+bool EventBridge::startCapture(const char* const path)
+{
+    return impl->startCapture(path);
+}
+
+void EventBridge::stopCapture()
+{
+    impl->stopCapture();
+}
+
 bool EventBridge::sendEvent(const EventType etype, const uint8_t index, const int32_t value)
 {
     return impl->sendEvent(etype, index, value);
 }
 
+bool EventBridge::setLEDEffect(const uint8_t index, const LEDEffect& effect)
+{
+    return impl->setLEDEffect(index, effect);
+}
+
 // --------------------------------------------------------------------------------------------------------------------
@@ -21,8 +21,20 @@ struct EventBridge {
 
         /**
          * Event trigger function, called when an event is received.
+         * @a time is the monotonic time in microseconds of when the event happened, see EventTimeUs().
+         * Backends use kernel timestamps where available, otherwise the time at which the event was read.
          */
-        virtual void eventReceived(EventType etype, EventState state, uint8_t index, int32_t value) = 0;
+        virtual void eventReceived(EventType etype, EventState state, uint8_t index, int32_t value, uint64_t time) = 0;
+
+        /**
+         * Batched event trigger function, called once per poll() with all events received during that cycle.
+         * The default implementation calls eventReceived() for each event, override it to handle events in bulk.
+         */
+        virtual void eventsReceived(const Event* const events, const uint32_t count)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+                eventReceived(events[i].etype, events[i].state, events[i].index, events[i].value, events[i].time);
+        }
     };
 
    /**
@@ -30,8 +42,11 @@ struct EventBridge {
     */
     std::string last_error;
 
-    /** constructor, optionally passing a callback for receiving events */
-    EventBridge(Callback* callback = nullptr);
+    /**
+     * constructor, optionally passing a callback for receiving events.
+     * @a actuators defines how many actuators of each type the device has, used for sizing internal state tables.
+     */
+    EventBridge(Callback* callback = nullptr, const EventActuators& actuators = EventActuators());
 
     /** destructor */
     virtual ~EventBridge();
@@ -39,9 +54,17 @@ struct EventBridge {
     /**  */
     bool addInput(EventInput::BackendType type, const char* id, uint8_t index = 0);
 
-    /**  */
+    /**
+     * Add a new output for a specific actuator index.
+     * Several outputs can be added for the same index, sendEvent() will trigger all of them in order of addition.
+     */
     bool addOutput(EventOutput::BackendType type, const char* id, uint8_t index);
 
+    /**
+     * Get the actuator configuration as given on construction.
+     */
+    const EventActuators& getActuators() const noexcept;
+
     /**
      * Clear current state, for preventing unwanted long-press events.
      */
@@ -53,17 +76,60 @@ struct EventBridge {
     void enableTapTempo(EventType etype, uint8_t index, bool enable = true);
 
     /**
-     * Event polling function, to be called at regular intervals.
-     * Will trigger event received callbacks if there were any events during the last period.
-     * @note this function is very likely to be replaced with an FD-based event polling later on.
+     * Set the window for coalescing encoder rotations, in milliseconds, 0 to disable.
+     * Only used by the libinput backend, applies to current and future inputs.
+     * Defaults to EVENT_BRIDGE_ENCODER_COALESCE_TIME.
+     */
+    void setEncoderCoalesceTime(uint16_t timeMs);
+
+    /**
+     * Set the acceleration curve for a specific encoder, applied by input backends as events are read.
+     * Applies to current and future inputs, encoders have no acceleration by default.
+     */
+    void setEncoderAcceleration(uint8_t index, const EncoderAcceleration& accel);
+
+    /**
+     * Get a file descriptor that becomes readable when there are events ready to be processed.
+     * Wait on it using poll/epoll/select, QSocketNotifier or similar, and call poll() once readable.
+     * Returns -1 if unavailable, in which case poll() must be called at regular intervals instead.
+     */
+    int getPollFD() const noexcept;
+
+    /**
+     * Event polling function, to be called when the poll FD is readable or at regular intervals.
+     * Will trigger event received callbacks if there were any events since the last call.
      */
     void poll();
 
+    /**
+     * Start capturing all received events into @a path, stopping any previous capture.
+     * Events are appended as binary records (see capture.hpp) once per poll() cycle, before being delivered.
+     * The file is created if needed, otherwise it must be an existing capture file of the same format.
+     * Captures can be played back with the replay input backend.
+     */
+    bool startCapture(const char* path);
+
+    /**
+     * Stop capturing events, does nothing if not capturing.
+     */
+    void stopCapture();
+
     /**
      * Event trigger function, to be called for sending events.
+     * Outputs are written asynchronously from a worker thread, so this never blocks on slow drivers.
+     * Only the latest value of each output is kept, repeated calls before the write happens result in a single write.
+     * Must always be called from the same thread.
      */
     bool sendEvent(EventType etype, uint8_t index, int32_t value);
 
+    /**
+     * Start an LED effect for a specific LED index, running inside the bridge until replaced.
+     * A later sendEvent() or effect for the same index replaces it, an effect of type kLEDEffectNone just stops it.
+     * Tempo effects follow tap-tempo events as received by poll().
+     * Must be called from the same thread as sendEvent().
+     */
+    bool setLEDEffect(uint8_t index, const LEDEffect& effect);
+
 private:
     struct Impl;
     Impl* const impl;
@@ -3,97 +3,196 @@
 
 #include "event-bridge.hpp"
 #include "events.hpp"
+#include "switches.hpp"
 
 #include <cassert>
 #include <cstdio>
-#include <cstring>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 // --------------------------------------------------------------------------------------------------------------------
 
-struct GPIOInput : EventInput {
+struct GPIOInput : EventInput,
+                   EventReactor::Handler {
+    EventReactor* const reactor;
     const uint8_t _index;
-    FILE* file = nullptr;
-    int lastvalue = -1;
-
-    GPIOInput(const char* const id, const uint8_t index)
-        : _index(index)
+    // GPIO value, read with pread so no seeking or stdio buffering is involved
+    int valuefd = -1;
+    // whether the kernel signals value changes, otherwise we sample it periodically
+    bool edgeTriggered = false;
+    // periodic timer for sampling the GPIO value, only used if the GPIO cannot signal edges
+    int timerfd = -1;
+    // debounce, long-press and tap-tempo handling
+    SwitchEngine switches;
+
+    GPIOInput(EventReactor* const reactor_, const EventActuators& actuators, const char* const id, const uint8_t index)
+        : reactor(reactor_),
+          _index(index),
+          switches(reactor_, this, actuators, 1)
     {
+        switches.setLine(0, index, EVENT_BRIDGE_GPIO_DEBOUNCE_TIME * 1000);
+
         char path[48] = {};
         std::snprintf(path, sizeof(path) - 1, "/sys/class/gpio/gpio%s/value", id);
-        file = std::fopen(path, "r");
-        assert(file != nullptr);
+        valuefd = open(path, O_RDONLY | O_CLOEXEC);
+        assert(valuefd != -1);
+
+        if (valuefd == -1)
+            return;
+
+        // the kernel signals edges as POLLPRI on the value file, only available for interrupt-capable GPIOs
+        const bool edges = enableEdges(id);
+
+        // report initial state, done before registering so the reactor thread is not handling the GPIO yet
+        // when using edges this also acknowledges any pending one
+        const int value = readValue();
+        if (value != -1)
+            switches.initial(0, value != 0, EventTimeUs());
+
+        if (edges)
+        {
+            edgeTriggered = reactor->addFD(valuefd, EPOLLPRI | EPOLLERR, this);
+            if (edgeTriggered)
+                return;
+        }
+
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (timerfd == -1)
+            return;
+
+        struct itimerspec its = {};
+        its.it_interval.tv_sec = EVENT_BRIDGE_POLL_INTERVAL / 1000;
+        its.it_interval.tv_nsec = (EVENT_BRIDGE_POLL_INTERVAL % 1000) * 1000000;
+        its.it_value = its.it_interval;
+        timerfd_settime(timerfd, 0, &its, nullptr);
+
+        reactor->addFD(timerfd, EPOLLIN, this);
     }
 
     ~GPIOInput() override
     {
-        if (file != nullptr)
-            std::fclose(file);
+        if (timerfd != -1)
+        {
+            reactor->removeFD(timerfd);
+            close(timerfd);
+        }
+
+        if (valuefd != -1)
+        {
+            if (edgeTriggered)
+                reactor->removeFD(valuefd);
+
+            close(valuefd);
+        }
+    }
+
+    void clear() override
+    {
+        switches.clear();
     }
 
-    void enableTapTempo(const uint8_t index, const bool enable) override
+    void enableTapTempo(const uint16_t slot, const bool enable) override
     {
-        // TODO
+        switches.enableTapTempo(slot, enable);
     }
 
-    // FIXME timer poll is bad, rework API to work via FDs directly
     void poll(Callback* const cb) override
     {
-        int value = 0;
+        switches.poll(cb);
+    }
 
-        if (file != nullptr)
+    void fdReady(const int fd, uint32_t) override
+    {
+        if (fd == timerfd)
         {
-            std::fseek(file, 0, SEEK_SET);
-            std::fscanf(file, "%d", &value);
+            uint64_t expirations;
+            read(timerfd, &expirations, sizeof(expirations));
         }
 
-        if (lastvalue != value)
-        {
-            lastvalue = value;
-            cb->event(kEventTypeFootswitch, value != 0 ? kEventStatePressed : kEventStateReleased, _index, 0);
-        }
+        const uint64_t time = EventTimeUs();
+        const int value = readValue();
+
+        if (value == -1)
+            return;
+
+        switches.changed(0, value != 0, time);
+        switches.flush();
+    }
+
+private:
+    static bool enableEdges(const char* const id)
+    {
+        char path[48] = {};
+        std::snprintf(path, sizeof(path) - 1, "/sys/class/gpio/gpio%s/edge", id);
+
+        const int fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+
+        const bool ok = write(fd, "both", 4) == 4;
+        close(fd);
+        return ok;
+    }
+
+    int readValue()
+    {
+        char buf[4];
+        if (pread(valuefd, buf, sizeof(buf), 0) <= 0)
+            return -1;
 
-        // TODO long press
+        return buf[0] != '0' ? 1 : 0;
     }
 };
 
 // --------------------------------------------------------------------------------------------------------------------
 
 struct GPIOOutput : EventOutput {
-    FILE* file = nullptr;
+    int valuefd = -1;
+    // last written value, writes of the same value are skipped
+    int32_t lastvalue = 0;
+    bool written = false;
 
     GPIOOutput(const char* const id)
     {
         char path[48] = {};
         std::snprintf(path, sizeof(path) - 1, "/sys/class/gpio/gpio%s/value", id);
-        file = std::fopen(path, "w");
-        assert(file != nullptr);
+        valuefd = open(path, O_WRONLY | O_CLOEXEC);
+        assert(valuefd != -1);
     }
 
     ~GPIOOutput() override
     {
-        if (file != nullptr)
-            std::fclose(file);
+        if (valuefd != -1)
+            close(valuefd);
     }
 
     void event(const int32_t value) override
     {
-        if (file != nullptr)
-        {
-            char svalue[12] = {};
-            std::snprintf(svalue, sizeof(svalue) - 1, "%d", value);
+        if (valuefd == -1 || (written && lastvalue == value))
+            return;
+
+        char svalue[12] = {};
+        const int len = std::snprintf(svalue, sizeof(svalue), "%d", value);
 
-            std::fseek(file, 0, SEEK_SET);
-            std::fwrite(svalue, std::strlen(svalue) + 1, 1, file);
-            std::fflush(file);
+        if (pwrite(valuefd, svalue, len, 0) == len)
+        {
+            lastvalue = value;
+            written = true;
         }
     }
 };
 
 // --------------------------------------------------------------------------------------------------------------------
 
-EventInput* createNewInput_GPIO(const char* const id, const uint8_t index)
+EventInput* createNewInput_GPIO(EventReactor* const reactor,
+                               const EventActuators& actuators,
+                               const char* const id,
+                               const uint8_t index)
 {
-    return new GPIOInput(id, index);
+    return new GPIOInput(reactor, actuators, id, index);
 }
 
 EventOutput* createNewOutput_GPIO(const char* const id)
@@ -0,0 +1,501 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#include "event-bridge.hpp"
+#include "events.hpp"
+#include "switches.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Set of lines of a single GPIO chip, requested together through the character-device line-request uAPI (v2).
+ *
+ * Parsed from ids like "chip:line,line,...", where chip is a device name like "gpiochip0" or a full path.
+ * Each line offset maps to a footswitch, starting at the index given on creation,
+ * unless explicitly given as "line=index".
+ * Lines must be unique and exist on the chip, and indexes must be valid footswitches.
+ */
+struct GPIOChipLines {
+    uint32_t count = 0;
+    // maximum amount of lines accepted in an id, set before request()
+    uint32_t maxCount = GPIO_V2_LINES_MAX;
+    uint32_t offsets[GPIO_V2_LINES_MAX];
+    uint8_t indexes[GPIO_V2_LINES_MAX];
+
+    // line request, values and events for all lines are read from here
+    int requestfd = -1;
+    // whether the kernel debounces the lines for us
+    bool kernelDebounce = false;
+
+    ~GPIOChipLines()
+    {
+        if (requestfd != -1)
+            close(requestfd);
+    }
+
+    /**
+     * Take over the lines requested by @a other, which is left without a request.
+     */
+    void take(GPIOChipLines& other) noexcept
+    {
+        *this = other;
+        other.requestfd = -1;
+    }
+
+    /**
+     * Parse @a id and request its lines with @a flags, including kernel debouncing if possible.
+     * Line indexes must be below @a numIndexes.
+     */
+    bool request(const char* const id, const uint8_t firstIndex, const uint32_t numIndexes, const uint64_t flags)
+    {
+        const char* const sep = std::strchr(id, ':');
+        if (sep == nullptr || sep == id || ! parseLines(sep + 1, firstIndex, numIndexes))
+        {
+            fprintf(stderr, "%s failed, invalid id '%s', must be 'chip:line,line,...'\n", __func__, id);
+            return false;
+        }
+
+        char path[64] = {};
+        if (id[0] == '/')
+            std::snprintf(path, sizeof(path) - 1, "%.*s", static_cast<int>(sep - id), id);
+        else
+            std::snprintf(path, sizeof(path) - 1, "/dev/%.*s", static_cast<int>(sep - id), id);
+
+        const int chipfd = open(path, O_RDONLY | O_CLOEXEC);
+        if (chipfd == -1)
+        {
+            fprintf(stderr, "%s failed, cannot open '%s': %s\n", __func__, path, std::strerror(errno));
+            return false;
+        }
+
+        struct gpiochip_info info = {};
+        if (ioctl(chipfd, GPIO_GET_CHIPINFO_IOCTL, &info) == 0)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                if (offsets[i] >= info.lines)
+                {
+                    fprintf(stderr, "%s failed, '%s' has no line %u\n", __func__, path, offsets[i]);
+                    close(chipfd);
+                    return false;
+                }
+            }
+        }
+
+        // try with debounce first, not every kernel and driver support it
+        requestfd = requestLines(chipfd, flags, EVENT_BRIDGE_GPIO_DEBOUNCE_TIME * 1000);
+
+        kernelDebounce = requestfd != -1 && EVENT_BRIDGE_GPIO_DEBOUNCE_TIME != 0;
+
+        if (requestfd == -1 && EVENT_BRIDGE_GPIO_DEBOUNCE_TIME != 0)
+            requestfd = requestLines(chipfd, flags, 0);
+
+        if (requestfd == -1)
+            fprintf(stderr, "%s failed, cannot request lines of '%s': %s\n", __func__, path, std::strerror(errno));
+
+        close(chipfd);
+        return requestfd != -1;
+    }
+
+    /**
+     * Set the value of the lines in @a mask at once, as a bitmask in line order.
+     * Returns false on failure.
+     */
+    bool writeValues(const uint64_t bits, const uint64_t mask) const
+    {
+        struct gpio_v2_line_values values = {};
+        values.bits = bits;
+        values.mask = mask;
+
+        return ioctl(requestfd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) == 0;
+    }
+
+    /**
+     * Read the current value of all lines at once, as a bitmask in line order.
+     * Returns false on failure.
+     */
+    bool readValues(uint64_t& bits) const
+    {
+        struct gpio_v2_line_values values = {};
+        values.mask = mask();
+
+        if (ioctl(requestfd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) != 0)
+            return false;
+
+        bits = values.bits;
+        return true;
+    }
+
+    /**
+     * Setup @a switches for all lines, debouncing in software if the kernel does not.
+     */
+    void setupSwitches(SwitchEngine& switches) const
+    {
+        for (uint32_t i = 0; i < count; ++i)
+            switches.setLine(i, indexes[i], kernelDebounce ? 0 : EVENT_BRIDGE_GPIO_DEBOUNCE_TIME * 1000);
+    }
+
+    /**
+     * Get the position of line @a offset within the request, -1 if not found.
+     */
+    int find(const uint32_t offset) const noexcept
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (offsets[i] == offset)
+                return i;
+        }
+
+        return -1;
+    }
+
+    uint64_t mask() const noexcept
+    {
+        return count == 64 ? ~0ULL : (1ULL << count) - 1;
+    }
+
+private:
+    // parse a "line[=index],..." list, rejecting anything else
+    bool parseLines(const char* s, const uint8_t firstIndex, const uint32_t numIndexes)
+    {
+        for (;;)
+        {
+            if (*s < '0' || *s > '9' || count == maxCount)
+                return false;
+
+            char* end;
+            const uint32_t offset = std::strtoul(s, &end, 10);
+            uint32_t index = firstIndex + count;
+
+            if (*end == '=')
+            {
+                if (end[1] < '0' || end[1] > '9')
+                    return false;
+
+                index = std::strtoul(end + 1, &end, 10);
+            }
+
+            if (index >= numIndexes || find(offset) != -1)
+                return false;
+
+            offsets[count] = offset;
+            indexes[count] = index;
+            ++count;
+
+            if (*end == '\0')
+                return true;
+
+            if (*end != ',')
+                return false;
+
+            s = end + 1;
+        }
+    }
+
+    int requestLines(const int chipfd, const uint64_t flags, const uint32_t debounceUs) const
+    {
+        struct gpio_v2_line_request req = {};
+        std::memcpy(req.offsets, offsets, sizeof(offsets[0]) * count);
+        std::snprintf(req.consumer, sizeof(req.consumer), "event-bridge");
+        req.num_lines = count;
+        req.config.flags = flags;
+
+        if (flags & (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING))
+            req.event_buffer_size = EVENT_BRIDGE_QUEUE_SIZE;
+
+        if (debounceUs != 0 && (flags & GPIO_V2_LINE_FLAG_INPUT) != 0)
+        {
+            req.config.num_attrs = 1;
+            req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+            req.config.attrs[0].attr.debounce_period_us = debounceUs;
+            req.config.attrs[0].mask = mask();
+        }
+
+        if (ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req) != 0)
+            return -1;
+
+        return req.fd;
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Edge-triggered GPIO input, handling several footswitches at once, see GPIOChipLines for the id format.
+ * All lines are requested together with edge detection, so a single read returns the events of every line,
+ * each with a monotonic kernel timestamp.
+ */
+struct GPIOChipInput : EventInput,
+                       EventReactor::Handler {
+    EventReactor* const reactor;
+    GPIOChipLines lines;
+    bool registered = false;
+
+    // debounce, long-press and tap-tempo handling
+    SwitchEngine switches;
+
+    // @a requested must have its lines already requested, they are taken over by this input
+    GPIOChipInput(EventReactor* const reactor_, const EventActuators& actuators, GPIOChipLines& requested)
+        : reactor(reactor_),
+          switches(reactor_, this, actuators, GPIO_V2_LINES_MAX)
+    {
+        lines.take(requested);
+
+        fcntl(lines.requestfd, F_SETFL, fcntl(lines.requestfd, F_GETFL) | O_NONBLOCK);
+
+        lines.setupSwitches(switches);
+
+        // report initial state, done before registering so the reactor thread is not handling the lines yet
+        uint64_t bits;
+        if (lines.readValues(bits))
+        {
+            const uint64_t time = EventTimeUs();
+
+            for (uint32_t i = 0; i < lines.count; ++i)
+                switches.initial(i, bits & (1ULL << i), time);
+        }
+
+        registered = reactor->addFD(lines.requestfd, EPOLLIN, this);
+    }
+
+    ~GPIOChipInput() override
+    {
+        if (registered)
+            reactor->removeFD(lines.requestfd);
+    }
+
+    void clear() override
+    {
+        switches.clear();
+    }
+
+    void enableTapTempo(const uint16_t slot, const bool enable) override
+    {
+        switches.enableTapTempo(slot, enable);
+    }
+
+    void poll(Callback* const cb) override
+    {
+        switches.poll(cb);
+    }
+
+    void fdReady(int, uint32_t) override
+    {
+        struct gpio_v2_line_event evs[16];
+        ssize_t ret;
+
+        while ((ret = read(lines.requestfd, evs, sizeof(evs))) > 0)
+        {
+            const uint32_t count = ret / sizeof(evs[0]);
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const int line = lines.find(evs[i].offset);
+                if (line == -1)
+                    continue;
+
+                // kernel timestamp, CLOCK_MONOTONIC by default, same as EventTimeUs()
+                switches.changed(line, evs[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE, evs[i].timestamp_ns / 1000);
+            }
+        }
+
+        switches.flush();
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Sampled GPIO bank input, for chips without edge detection or where sampling is preferred.
+ * Uses the same id format as GPIOChipLines, reading all lines with a single ioctl per sampling interval
+ * and finding changes across the whole bank with a single bitmask compare.
+ */
+struct GPIOBankInput : EventInput,
+                       EventReactor::Handler {
+    EventReactor* const reactor;
+    GPIOChipLines lines;
+    // periodic timer for sampling the GPIO values
+    int timerfd = -1;
+    // last sampled values, only accessed by the reactor thread
+    uint64_t lastBits = 0;
+
+    // debounce, long-press and tap-tempo handling
+    SwitchEngine switches;
+
+    // @a requested must have its lines already requested, they are taken over by this input
+    GPIOBankInput(EventReactor* const reactor_, const EventActuators& actuators, GPIOChipLines& requested)
+        : reactor(reactor_),
+          switches(reactor_, this, actuators, GPIO_V2_LINES_MAX)
+    {
+        lines.take(requested);
+
+        lines.setupSwitches(switches);
+
+        // report initial state, done before registering so the reactor thread is not handling the lines yet
+        if (lines.readValues(lastBits))
+        {
+            const uint64_t time = EventTimeUs();
+
+            for (uint32_t i = 0; i < lines.count; ++i)
+                switches.initial(i, lastBits & (1ULL << i), time);
+        }
+
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (timerfd == -1)
+            return;
+
+        struct itimerspec its = {};
+        its.it_interval.tv_sec = EVENT_BRIDGE_POLL_INTERVAL / 1000;
+        its.it_interval.tv_nsec = (EVENT_BRIDGE_POLL_INTERVAL % 1000) * 1000000;
+        its.it_value = its.it_interval;
+        timerfd_settime(timerfd, 0, &its, nullptr);
+
+        reactor->addFD(timerfd, EPOLLIN, this);
+    }
+
+    ~GPIOBankInput() override
+    {
+        if (timerfd != -1)
+        {
+            reactor->removeFD(timerfd);
+            close(timerfd);
+        }
+    }
+
+    void clear() override
+    {
+        switches.clear();
+    }
+
+    void enableTapTempo(const uint16_t slot, const bool enable) override
+    {
+        switches.enableTapTempo(slot, enable);
+    }
+
+    void poll(Callback* const cb) override
+    {
+        switches.poll(cb);
+    }
+
+    void fdReady(int, uint32_t) override
+    {
+        uint64_t expirations;
+        read(timerfd, &expirations, sizeof(expirations));
+
+        uint64_t bits;
+        if (! lines.readValues(bits))
+            return;
+
+        uint64_t changed = bits ^ lastBits;
+
+        if (changed == 0)
+            return;
+
+        lastBits = bits;
+
+        const uint64_t time = EventTimeUs();
+
+        for (; changed != 0; changed &= changed - 1)
+        {
+            const uint32_t line = __builtin_ctzll(changed);
+            switches.changed(line, bits & (1ULL << line), time);
+        }
+
+        switches.flush();
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * GPIO output driving several lines at once, using the same id format as GPIOChipLines (indexes are ignored).
+ * With a single line any non-zero value sets it high, otherwise bit N of the value drives line N,
+ * so ids are limited to 32 lines.
+ * Only lines whose value changed are written, all of them with a single ioctl.
+ */
+struct GPIOChipOutput : EventOutput {
+    GPIOChipLines lines;
+    // last written values, lines are requested low
+    uint64_t lastBits = 0;
+
+    GPIOChipOutput(const char* const id)
+    {
+        lines.maxCount = 32;
+        lines.request(id, 0, UINT8_MAX + 1, GPIO_V2_LINE_FLAG_OUTPUT);
+    }
+
+    void event(const int32_t value) override
+    {
+        if (lines.requestfd == -1)
+            return;
+
+        const uint64_t bits = lines.count == 1 ? (value != 0 ? 1 : 0)
+                                               : static_cast<uint32_t>(value) & lines.mask();
+        const uint64_t changed = bits ^ lastBits;
+
+        if (changed != 0 && lines.writeValues(bits, changed))
+            lastBits = bits;
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+EventInput* createNewInput_GPIOChip(EventReactor* const reactor,
+                                   const EventActuators& actuators,
+                                   const char* const id,
+                                   const uint8_t index)
+{
+    // request lines before creating the input, so nothing touches the reactor on failure
+    GPIOChipLines lines;
+
+    // request() already reported why
+    if (! lines.request(id, index, actuators.numFootswitches, GPIO_V2_LINE_FLAG_INPUT
+                                                            | GPIO_V2_LINE_FLAG_EDGE_RISING
+                                                            | GPIO_V2_LINE_FLAG_EDGE_FALLING))
+        return nullptr;
+
+    return new GPIOChipInput(reactor, actuators, lines);
+}
+
+EventInput* createNewInput_GPIOBank(EventReactor* const reactor,
+                                   const EventActuators& actuators,
+                                   const char* const id,
+                                   const uint8_t index)
+{
+    // request lines before creating the input, so nothing touches the reactor on failure
+    GPIOChipLines lines;
+
+    // request() already reported why
+    if (! lines.request(id, index, actuators.numFootswitches, GPIO_V2_LINE_FLAG_INPUT))
+        return nullptr;
+
+    return new GPIOBankInput(reactor, actuators, lines);
+}
+
+EventOutput* createNewOutput_GPIOChip(const char* const id)
+{
+    GPIOChipOutput* const output = new GPIOChipOutput(id);
+
+    // request() already reported why
+    if (output->lines.requestfd == -1)
+    {
+        delete output;
+        return nullptr;
+    }
+
+    return output;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
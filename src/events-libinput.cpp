@@ -2,18 +2,20 @@
 // SPDX-License-Identifier: ISC
 
 #include "event-bridge.hpp"
+#include "acceleration.hpp"
+#include "actuators.hpp"
 #include "events.hpp"
+#include "ringbuffer.hpp"
 
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
-#include <ctime>
 #include <vector>
 
 #include <fcntl.h>
 #include <libinput.h>
-#include <poll.h>
-#include <pthread.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -36,66 +38,60 @@
 
 // --------------------------------------------------------------------------------------------------------------------
 
-static uint32_t get_time_ms() noexcept
-{
-    static struct {
-        timespec ts;
-        int r;
-        uint32_t ms;
-    } s = {
-        {},
-        clock_gettime(CLOCK_MONOTONIC_RAW, &s.ts),
-        static_cast<uint32_t>(s.ts.tv_sec * 1000 + s.ts.tv_nsec / 1000000)
-    };
-
-    timespec ts;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-    return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) - s.ms;
-}
-
-static uint32_t abs_delta(const uint32_t a, const uint32_t b) noexcept
-{
-    return a > b ? b - a : a - b;
-}
-
-// --------------------------------------------------------------------------------------------------------------------
-
-struct LibInput : EventInput {
+struct LibInput : EventInput,
+                  EventReactor::Handler {
+    EventReactor* const reactor;
     struct libinput* context = nullptr;
     struct libinput_device* device = nullptr;
     int fd = -1;
-    struct State {
-        uint32_t time = 0;
-        EventState value = kEventStateReleased;
-    } state[NUM_ENCODERS + NUM_FOOTSWITCHES];
-    struct TapTempo {
-        uint64_t time = 0;
-        uint32_t value = 0;
-        bool enabled = false;
-        bool updated = false;
-    } tapTempo[NUM_ENCODERS + NUM_FOOTSWITCHES];
-
-    struct QueueEvent {
-        EventType etype;
-        EventState evalue;
-        uint8_t index;
-        int32_t value;
+
+    // live state, only accessed by the reactor thread except for tap-tempo flags
+    ActuatorTable actuators;
+
+    // encoder acceleration, applied to every detent before coalescing
+    EncoderAccelerator accelerator;
+
+    // encoder rotations being coalesced, indexed by encoder slot, only accessed by the reactor thread
+    struct Rotation {
+        // accumulated delta not yet queued
+        int32_t delta;
+        // time of the last accumulated detent
+        uint64_t time;
+        // end of the current coalescing window, 0 if none is open
+        uint64_t windowEnd;
+        // direction of the current window as given by its leading detent, 1 or -1
+        int32_t direction;
     };
-    std::vector<QueueEvent> events;
+    std::vector<Rotation> rotations;
 
-    // copies
-    std::vector<QueueEvent> events2;
-    TapTempo tapTempo2[NUM_ENCODERS + NUM_FOOTSWITCHES];
+    // coalescing window in microseconds, written by the poll thread
+    std::atomic<uint32_t> coalesceTime { EVENT_BRIDGE_ENCODER_COALESCE_TIME * 1000 };
 
-    pthread_mutex_t lock = {};
+    RingBuffer<Event, EVENT_BRIDGE_QUEUE_SIZE> events;
+    uint32_t lastOverflowCount = 0;
 
-    struct {
-        pthread_t handle = {};
-        bool running = false;
-    } thread;
+    // request from poll thread for the reactor thread to reset its state
+    std::atomic<bool> clearRequested { false };
 
-    LibInput(const char* const path)
+    // whether new events were queued since last notify, only used by the reactor thread
+    bool notifyPending = false;
+
+    LibInput(EventReactor* const reactor_,
+             const EventActuators& actuators_,
+             const char* const path,
+             const EventEncoderSettings& encoders)
+        : reactor(reactor_),
+          actuators(actuators_),
+          accelerator(actuators_.numEncoders),
+          rotations(actuators_.numEncoders, Rotation {}),
+          coalesceTime(static_cast<uint32_t>(encoders.coalesceTime) * 1000)
     {
+        if (encoders.accelerations != nullptr)
+        {
+            for (uint8_t i = 0; i < actuators_.numEncoders; ++i)
+                accelerator.setCurve(i, encoders.accelerations[i]);
+        }
+
         static constexpr const struct libinput_interface _interface = {
             .open_restricted = _open_restricted,
             .close_restricted = _close_restricted,
@@ -114,22 +110,15 @@ struct LibInput : EventInput {
 
         libinput_device_ref(device);
 
-        pthread_mutex_init(&lock, nullptr);
-
-        thread.running = true;
-        if (pthread_create(&thread.handle, nullptr, _run, this) != 0)
-            thread.running = false;
+        reactor->addFD(fd, EPOLLIN, this);
     }
 
     ~LibInput() override
     {
-        if (thread.running)
-        {
-            thread.running = false;
-            pthread_join(thread.handle, nullptr);
-        }
+        if (device != nullptr)
+            reactor->removeFD(fd);
 
-        pthread_mutex_destroy(&lock);
+        reactor->cancelTimers(this);
 
         if (device != nullptr)
         {
@@ -143,114 +132,105 @@ struct LibInput : EventInput {
 
     void clear() override
     {
-        pthread_mutex_lock(&lock);
-
-        for (int i = 0; i < sizeof(state)/sizeof(state[0]); ++i)
-        {
-            state[i].time = 0;
-            state[i].value = kEventStateReleased;
-        }
-
-        for (int i = 0; i < sizeof(tapTempo)/sizeof(tapTempo[0]); ++i)
-        {
-            tapTempo[i].time = 0;
-            tapTempo[i].value = 0;
-            tapTempo[i].enabled = false;
-            tapTempo[i].updated = false;
-        }
-
+        // reactor thread resets its own state, we only drop what is already queued
+        clearRequested.store(true, std::memory_order_release);
         events.clear();
-
-        pthread_mutex_unlock(&lock);
     }
 
-    void enableTapTempo(const uint8_t index, const bool enable) override
+    void enableTapTempo(const uint16_t slot, const bool enable) override
     {
-        assert(index < NUM_ENCODERS + NUM_FOOTSWITCHES);
+        if (slot >= actuators.count)
+            return;
 
-        pthread_mutex_lock(&lock);
+        actuators.tapEnabled[slot].store(enable, std::memory_order_relaxed);
+        actuators.tapReset[slot].store(true, std::memory_order_release);
+    }
 
-        tapTempo[index].time = 0;
-        tapTempo[index].value = 0;
-        tapTempo[index].enabled = enable;
-        tapTempo[index].updated = false;
+    void setEncoderCoalesceTime(const uint16_t timeMs) override
+    {
+        coalesceTime.store(static_cast<uint32_t>(timeMs) * 1000, std::memory_order_relaxed);
+    }
 
-        pthread_mutex_unlock(&lock);
+    void setEncoderAcceleration(const uint8_t index, const EncoderAcceleration& accel) override
+    {
+        accelerator.setCurve(index, accel);
     }
 
     void poll(Callback* const cb) override
     {
-        if (! thread.running)
-            readInput(1);
+        Event batch[32];
 
-        copy2();
+        for (uint32_t count; (count = events.pop(batch, sizeof(batch)/sizeof(batch[0]))) != 0;)
+            cb->events(batch, count);
 
-        for (const QueueEvent& ev : events2)
-            cb->event(ev.etype, ev.evalue, ev.index, ev.value);
+        const uint32_t overflowCount = events.getOverflowCount();
 
-        for (int i = 0; i < sizeof(tapTempo2)/sizeof(tapTempo2[0]); ++i)
+        if (lastOverflowCount != overflowCount)
         {
-            if (! tapTempo2[i].updated)
-                continue;
-
-            tapTempo2[i].updated = false;
-
-            if (i < NUM_ENCODERS)
-                cb->event(kEventTypeEncoder, kEventStateTapTempo, i, tapTempo2[i].value);
-            else
-                cb->event(kEventTypeFootswitch, kEventStateTapTempo, i - NUM_ENCODERS, tapTempo2[i].value);
+            fprintf(stderr, "LibInput event queue overflow, %u events dropped\n", overflowCount - lastOverflowCount);
+            lastOverflowCount = overflowCount;
         }
     }
 
-private:
-    void copy2()
+    void fdReady(int, uint32_t) override
     {
-        pthread_mutex_lock(&lock);
+        handleClearRequest();
+        readInput();
+        flushNotify();
+    }
 
-        events.swap(events2);
-        events.clear();
+    // timer ids below the actuator count are long-press deadlines for that slot,
+    // above it they are the end of a coalescing window for encoder slot (id - count)
+    void timerExpired(const uint32_t id, const uint64_t deadline) override
+    {
+        handleClearRequest();
 
-        for (int i = 0; i < sizeof(tapTempo)/sizeof(tapTempo[0]); ++i)
+        if (id >= actuators.count)
         {
-            if (tapTempo[i].updated)
-            {
-                tapTempo2[i] = tapTempo[i];
-                tapTempo[i].updated = false;
-            }
+            const uint16_t slot = id - actuators.count;
+            flushRotation(slot);
+            rotations[slot].windowEnd = 0;
+            flushNotify();
+            return;
         }
 
-        pthread_mutex_unlock(&lock);
-    }
+        const uint16_t slot = id;
 
-    static void* _run(void* const arg)
-    {
-        static_cast<LibInput*>(arg)->run();
-        return nullptr;
+        if (actuators.state[slot] == kEventStatePressed)
+        {
+            actuators.pressTime[slot] = 0;
+            actuators.state[slot] = kEventStateLongPressed;
+            queueEvent(slot, kEventStateLongPressed, 0, deadline);
+        }
+
+        flushNotify();
     }
 
-    void run()
+private:
+    void flushNotify()
     {
-        static constexpr const uint32_t timeoutMs = 100;
-
-        while (thread.running)
-            readInput(timeoutMs);
+        if (notifyPending)
+        {
+            notifyPending = false;
+            notify();
+        }
     }
 
-    void readInput(const uint32_t timeoutMs)
+    void handleClearRequest()
     {
-        struct pollfd fds[1] = {};
-        fds[0].fd = fd;
-        fds[0].events = POLLIN;
-        fds[0].revents = 0;
+        if (! clearRequested.exchange(false, std::memory_order_acquire))
+            return;
 
-        const int rc = ::poll(fds, 1, timeoutMs);
+        reactor->cancelTimers(this);
+        actuators.reset();
+        accelerator.reset();
 
-        if (rc == 0)
-        {
-            updateLongPresses();
-            return;
-        }
+        for (Rotation& rotation : rotations)
+            rotation = {};
+    }
 
+    void readInput()
+    {
         libinput_dispatch(context);
 
         for (struct libinput_event* event; (event = libinput_get_event(context)) != nullptr;)
@@ -259,131 +239,112 @@ private:
             {
                 struct libinput_event_keyboard* const keyevent = libinput_event_get_keyboard_event(event);
                 const uint32_t keycode = libinput_event_keyboard_get_key(keyevent);
-                uint8_t index;
-
-                pthread_mutex_lock(&lock);
+                // kernel timestamp, libinput uses CLOCK_MONOTONIC same as EventTimeUs()
+                const uint64_t time = libinput_event_keyboard_get_time_usec(keyevent);
 
-                switch (keycode)
+                if (keycode >= ENCODER_CLICK_START && keycode < ENCODER_CLICK_START + actuators.numEncoders)
+                {
+                    const bool pressed = libinput_event_keyboard_get_key_state(keyevent) == LIBINPUT_KEY_STATE_PRESSED;
+                    handleClick(keycode - ENCODER_CLICK_START, pressed, time);
+                }
+                else if (keycode >= ENCODER_LEFT_START && keycode < ENCODER_LEFT_START + actuators.numEncoders)
+                {
+                    handleRotation(keycode - ENCODER_LEFT_START, -1, time);
+                }
+                else if (keycode >= ENCODER_RIGHT_START && keycode < ENCODER_RIGHT_START + actuators.numEncoders)
+                {
+                    handleRotation(keycode - ENCODER_RIGHT_START, 1, time);
+                }
+                else if (keycode >= FOOTSWITCH_CLICK_START
+                      && keycode < FOOTSWITCH_CLICK_START + actuators.numFootswitches)
+                {
+                    const bool pressed = libinput_event_keyboard_get_key_state(keyevent) == LIBINPUT_KEY_STATE_PRESSED;
+                    handleClick(actuators.numEncoders + keycode - FOOTSWITCH_CLICK_START, pressed, time);
+                }
+                else
                 {
-                case ENCODER_CLICK_START ... ENCODER_CLICK_START + NUM_ENCODERS:
-                    index = keycode - ENCODER_CLICK_START;
-                    if (libinput_event_keyboard_get_key_state(keyevent) == LIBINPUT_KEY_STATE_PRESSED)
-                    {
-                        state[index].time = get_time_ms();
-                        state[index].value = kEventStatePressed;
-
-                        if (tapTempo[index].enabled)
-                            updateTapTempo(index, libinput_event_keyboard_get_time_usec(keyevent));
-                    }
-                    else
-                    {
-                        state[index].time = 0;
-                        state[index].value = kEventStateReleased;
-                    }
-                    queueEvent(kEventTypeEncoder, state[index].value, index, 0);
-                    break;
-
-                case ENCODER_LEFT_START ... ENCODER_LEFT_START + NUM_ENCODERS:
-                    index = keycode - ENCODER_LEFT_START;
-                    queueEvent(kEventTypeEncoder, state[index].value, index, -1);
-                    break;
-
-                case ENCODER_RIGHT_START ... ENCODER_RIGHT_START + NUM_ENCODERS:
-                    index = keycode - ENCODER_RIGHT_START;
-                    queueEvent(kEventTypeEncoder, state[index].value, index, 1);
-                    break;
-
-                case FOOTSWITCH_CLICK_START ... FOOTSWITCH_CLICK_START + NUM_FOOTSWITCHES:
-                    index = keycode - FOOTSWITCH_CLICK_START;
-                    if (libinput_event_keyboard_get_key_state(keyevent) == LIBINPUT_KEY_STATE_PRESSED)
-                    {
-                        state[NUM_ENCODERS + index].time = get_time_ms();
-                        state[NUM_ENCODERS + index].value = kEventStatePressed;
-
-                        if (tapTempo[NUM_ENCODERS + index].enabled)
-                            updateTapTempo(NUM_ENCODERS + index, libinput_event_keyboard_get_time_usec(keyevent));
-                    }
-                    else
-                    {
-                        state[NUM_ENCODERS + index].time = 0;
-                        state[NUM_ENCODERS + index].value = kEventStateReleased;
-                    }
-                    queueEvent(kEventTypeFootswitch, state[NUM_ENCODERS + index].value, index, 0);
-                    break;
-
-                default:
                     printf("unused event keycode %d\n", keycode);
-                    break;
                 }
-
-                pthread_mutex_unlock(&lock);
             }
 
             libinput_event_destroy(event);
         }
-
-        updateLongPresses();
-    }
-
-    inline void queueEvent(EventType etype, EventState evalue, uint8_t index, int32_t value)
-    {
-        events.push_back({ etype, evalue, index, value });
     }
 
-    void updateLongPresses()
+    void handleRotation(const uint16_t slot, const int32_t detent, const uint64_t time)
     {
-        // only ask for current time as needed
-        uint32_t now = 0;
-
-        pthread_mutex_lock(&lock);
+        Rotation& rotation = rotations[slot];
+        const int32_t direction = detent;
+        const int32_t delta = accelerator.apply(slot, detent, time);
+        const uint32_t window = coalesceTime.load(std::memory_order_relaxed);
 
-        for (int i = 0; i < sizeof(state)/sizeof(state[0]); ++i)
+        // merge into the open window if going in the same direction
+        if (rotation.windowEnd != 0 && time < rotation.windowEnd && rotation.direction == direction)
         {
-            if (state[i].value != kEventStatePressed)
-                continue;
-
-            if (now == 0)
-                now = get_time_ms();
-
-            if (now - state[i].time < EVENT_BRIDGE_LONG_PRESS_TIME)
-                continue;
+            rotation.delta += delta;
+            rotation.time = time;
+            return;
+        }
 
-            state[i].time = 0;
-            state[i].value = kEventStateLongPressed;
+        // otherwise deliver what was pending, then this detent right away as the leading edge of a new window
+        flushRotation(slot);
+        queueEvent(slot, actuators.state[slot], delta, time);
 
-            if (i < NUM_ENCODERS)
-                queueEvent(kEventTypeEncoder, state[i].value, i, 0);
-            else
-                queueEvent(kEventTypeFootswitch, state[i].value, i - NUM_ENCODERS, 0);
+        if (window == 0)
+        {
+            if (rotation.windowEnd != 0)
+            {
+                rotation.windowEnd = 0;
+                reactor->cancelTimer(this, actuators.count + slot);
+            }
+            return;
         }
 
-        pthread_mutex_unlock(&lock);
+        rotation.windowEnd = time + window;
+        rotation.direction = direction;
+        reactor->armTimer(this, actuators.count + slot, rotation.windowEnd);
     }
 
-    void updateTapTempo(const uint8_t index, const uint64_t timeUs)
+    void flushRotation(const uint16_t slot)
     {
-        const uint64_t last = tapTempo[index].time;
-        tapTempo[index].time = timeUs;
+        Rotation& rotation = rotations[slot];
 
-        if (last == 0 || timeUs <= last)
+        if (rotation.delta == 0)
             return;
 
-        uint32_t delta = timeUs - last;
+        queueEvent(slot, actuators.state[slot], rotation.delta, rotation.time);
+        rotation.delta = 0;
+    }
+
+    void handleClick(const uint16_t slot, const bool pressed, const uint64_t time)
+    {
+        // keep rotations and clicks of the same encoder in order
+        if (slot < actuators.numEncoders)
+            flushRotation(slot);
 
-        if (delta > EVENT_BRIDGE_TAP_TEMPO_TIMEOUT * 1000)
+        if (pressed)
         {
-            if (delta - EVENT_BRIDGE_TAP_TEMPO_TIMEOUT_OVERFLOW * 1000 > EVENT_BRIDGE_TAP_TEMPO_TIMEOUT * 1000)
-                return;
+            actuators.pressTime[slot] = time;
+            actuators.state[slot] = kEventStatePressed;
+            reactor->armTimer(this, slot, time + EVENT_BRIDGE_LONG_PRESS_TIME * 1000);
+            queueEvent(slot, kEventStatePressed, 0, time);
 
-            delta = EVENT_BRIDGE_TAP_TEMPO_TIMEOUT * 1000;
+            if (actuators.tapEnabled[slot].load(std::memory_order_relaxed) && actuators.updateTapTempo(slot, time))
+                queueEvent(slot, kEventStateTapTempo, actuators.tapValue[slot], time);
         }
-
-        if (abs_delta(tapTempo[index].value, delta) < EVENT_BRIDGE_TAP_TEMPO_HYSTERESIS * 1000)
-            tapTempo[index].value = (tapTempo[index].value * 2 + delta) / 3;
         else
-            tapTempo[index].value = delta;
+        {
+            actuators.pressTime[slot] = 0;
+            actuators.state[slot] = kEventStateReleased;
+            reactor->cancelTimer(this, slot);
+            queueEvent(slot, kEventStateReleased, 0, time);
+        }
+    }
 
-        tapTempo[index].updated = true;
+    inline void queueEvent(const uint16_t slot, const EventState state, const int32_t value, const uint64_t time)
+    {
+        events.push({ actuators.typeAt(slot), state, actuators.indexAt(slot), value, time });
+        notifyPending = true;
     }
 
     static int _open_restricted(const char* const path, const int flags, void*)
@@ -400,9 +361,12 @@ private:
 
 // --------------------------------------------------------------------------------------------------------------------
 
-EventInput* createNewInput_LibInput(const char* const path)
+EventInput* createNewInput_LibInput(EventReactor* const reactor,
+                                   const EventActuators& actuators,
+                                   const char* const path,
+                                   const EventEncoderSettings& encoders)
 {
-    return new LibInput(path);
+    return new LibInput(reactor, actuators, path, encoders);
 }
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -1,103 +1,393 @@
 // SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
 // SPDX-License-Identifier: ISC
 
+#include "acceleration.hpp"
+#include "actuators.hpp"
 #include "event-bridge.hpp"
 #include "events.hpp"
+#include "ringbuffer.hpp"
 
-#include <cassert>
+#include <atomic>
 #include <cstdio>
-#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
 
-#include <pthread.h>
 #include <libserialport.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <unistd.h>
 
 // --------------------------------------------------------------------------------------------------------------------
+// Devices can speak one of two protocols, detected automatically from the first messages received.
+//
+// Text protocol, one message per line:
+//  - "A +1\n" or "A -1\n" for encoder rotations, uppercase letter is the index and the number is the delta
+//  - "a 1\n" or "a 0\n" for encoder button presses and releases, lowercase letter is the index
+//
+// Binary protocol, fixed-size frames of 7 bytes:
+//  - sync byte, 0xA5
+//  - type (upper 2 bits: 0 for rotation, 1 for release, 2 for press) and index (lower 6 bits)
+//  - rotation delta as signed 8-bit value, 0 for presses and releases
+//  - device timestamp in microseconds, 24-bit little-endian (wraps around every ~16.7 seconds)
+//  - CRC-8 (polynomial 0x07, initial value 0) of all previous bytes
+// Device timestamps are used as event times, so tap-tempo is not affected by transmission jitter.
+//
+// LED outputs sharing the port send values using the same protocol as the device, text until it is known:
+//  - "L3 16711680\n" in text mode, LED index followed by the value
+//  - type 3 frames in binary mode, with the LED index (up to 63) and the value as 32-bit little-endian
+//    in place of delta and timestamp
+
+static constexpr const uint32_t kFrameSize = 7;
+static constexpr const uint8_t kFrameSync = 0xA5;
+static constexpr const uint8_t kFrameTypeRotation = 0;
+static constexpr const uint8_t kFrameTypeRelease = 1;
+static constexpr const uint8_t kFrameTypePress = 2;
+static constexpr const uint8_t kFrameTypeLED = 3;
+static constexpr const uint64_t kFrameTimeWrap = 1 << 24;
+// maximum expected delay between an event happening on the device and us reading it, in microseconds
+static constexpr const uint64_t kFrameMaxLatency = 50000;
+// time to wait before reading again when the event queue is full, in microseconds
+static constexpr const uint64_t kResumeInterval = 1000;
+// maximum time to wait for LED writes to go through, in milliseconds
+static constexpr const unsigned int kWriteTimeout = 50;
+// longest text LED message, including the null terminator written by snprintf
+static constexpr const uint32_t kTextLEDMaxSize = sizeof("L255 -2147483648\n");
+
+enum SerialProtocol : uint8_t {
+    kSerialProtocolDetect,
+    kSerialProtocolText,
+    kSerialProtocolBinary,
+};
 
-static uint32_t get_time_ms() noexcept
+// CRC-8 with polynomial 0x07, as used by binary frames
+static uint8_t crc8(const uint8_t* const data, const uint32_t size) noexcept
 {
-    static struct {
-        timespec ts;
-        int r;
-        uint32_t ms;
-    } s = {
-        {},
-        clock_gettime(CLOCK_MONOTONIC_RAW, &s.ts),
-        static_cast<uint32_t>(s.ts.tv_sec * 1000 + s.ts.tv_nsec / 1000000)
-    };
+    uint8_t crc = 0;
 
-    timespec ts;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-    return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) - s.ms;
-}
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        crc ^= data[i];
 
-static uint32_t abs_delta(const uint32_t a, const uint32_t b) noexcept
-{
-    return a > b ? b - a : a - b;
+        for (int b = 0; b < 8; ++b)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+
+    return crc;
 }
 
 // --------------------------------------------------------------------------------------------------------------------
 
-struct LibSerialPort : EventInput {
-    struct sp_port* serialport = nullptr;
-    struct State {
-        // live state
-        uint32_t time = 0;
-        EventState state = kEventStateReleased;
-        // accumulated state
-        bool changed = false;
-        int32_t value = 0;
-    } state[NUM_ENCODERS];
-    struct TapTempo {
-        uint32_t time = 0;
-        uint32_t value = 0;
-        bool enabled = false;
-        bool updated = false;
-    } tapTempo[NUM_ENCODERS];
-
-    // copies
-    State state2[NUM_ENCODERS];
-    TapTempo tapTempo2[NUM_ENCODERS];
-
-    pthread_mutex_t lock = {};
-
-    struct {
-        pthread_t handle = {};
-        bool running = false;
-    } thread;
-
-    LibSerialPort(const char* const path, const int baudrate = 115200)
+/**
+ * Serial port shared by the input and outputs using the same device, opened once and reference counted.
+ * LED values are coalesced here, so that only the latest value of each LED is sent,
+ * with all pending LEDs written at once.
+ */
+struct SerialPort {
+    std::string path;
+    struct sp_port* port = nullptr;
+    uint32_t refs = 0;
+
+    // protocol spoken by the device, as detected by the input side
+    std::atomic<uint8_t> protocol { kSerialProtocolDetect };
+
+    /**
+     * Get the shared port for @a path, opening it if needed.
+     * Returns null if the port cannot be opened.
+     */
+    static SerialPort* acquire(const char* const path, const int baudrate = 115200)
+    {
+        pthread_mutex_lock(&registryLock);
+
+        for (SerialPort* const sp : registry)
+        {
+            if (sp->path == path)
+            {
+                ++sp->refs;
+                pthread_mutex_unlock(&registryLock);
+                return sp;
+            }
+        }
+
+        SerialPort* sp = new SerialPort(path, baudrate);
+
+        if (sp->port != nullptr)
+        {
+            sp->refs = 1;
+            registry.push_back(sp);
+        }
+        else
+        {
+            delete sp;
+            sp = nullptr;
+        }
+
+        pthread_mutex_unlock(&registryLock);
+        return sp;
+    }
+
+    /**
+     * Release a port previously acquired, closing it once no longer used.
+     */
+    static void release(SerialPort* const sp)
+    {
+        pthread_mutex_lock(&registryLock);
+
+        if (--sp->refs == 0)
+        {
+            for (auto it = registry.begin(); it != registry.end(); ++it)
+            {
+                if (*it == sp)
+                {
+                    registry.erase(it);
+                    break;
+                }
+            }
+
+            delete sp;
+        }
+
+        pthread_mutex_unlock(&registryLock);
+    }
+
+    /**
+     * Set the latest value of @a led, to be sent on the next flushLEDs().
+     */
+    void setLED(const uint8_t led, const int32_t value)
+    {
+        pthread_mutex_lock(&ledLock);
+        ledValues[led] = value;
+        ledDirty[led / 64] |= 1ull << (led % 64);
+        pthread_mutex_unlock(&ledLock);
+    }
+
+    /**
+     * Send all pending LED values with a single write.
+     */
+    void flushLEDs()
+    {
+        pthread_mutex_lock(&ledLock);
+
+        const bool binary = protocol.load(std::memory_order_relaxed) == kSerialProtocolBinary;
+        uint32_t len = 0;
+
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            for (uint64_t dirty = ledDirty[i]; dirty != 0; dirty &= dirty - 1)
+            {
+                const uint8_t led = i * 64 + __builtin_ctzll(dirty);
+                const int32_t value = ledValues[led];
+
+                if (! binary)
+                {
+                    const int ret = std::snprintf(writeBuffer + len, sizeof(writeBuffer) - len,
+                                                  "L%u %d\n", led, value);
+
+                    if (ret > 0 && static_cast<uint32_t>(ret) < sizeof(writeBuffer) - len)
+                        len += ret;
+
+                    continue;
+                }
+
+                // binary frames can only address 64 LEDs
+                if (led >= 64)
+                    continue;
+
+                uint8_t* const frame = reinterpret_cast<uint8_t*>(writeBuffer + len);
+                frame[0] = kFrameSync;
+                frame[1] = kFrameTypeLED << 6 | led;
+                frame[2] = value & 0xff;
+                frame[3] = (value >> 8) & 0xff;
+                frame[4] = (value >> 16) & 0xff;
+                frame[5] = (value >> 24) & 0xff;
+                frame[6] = crc8(frame, kFrameSize - 1);
+                len += kFrameSize;
+            }
+
+            ledDirty[i] = 0;
+        }
+
+        if (len != 0 && sp_blocking_write(port, writeBuffer, len, kWriteTimeout) != static_cast<int>(len))
+            fprintf(stderr, "Serial output: failed to write LED values to '%s'\n", path.c_str());
+
+        pthread_mutex_unlock(&ledLock);
+    }
+
+private:
+    // LED values waiting to be sent, protected by ledLock
+    pthread_mutex_t ledLock = {};
+    int32_t ledValues[UINT8_MAX + 1] = {};
+    uint64_t ledDirty[4] = {};
+    // big enough for every LED in either protocol
+    char writeBuffer[(UINT8_MAX + 1) * kTextLEDMaxSize];
+
+    static std::vector<SerialPort*> registry;
+    static pthread_mutex_t registryLock;
+
+    SerialPort(const char* const path_, const int baudrate)
+        : path(path_)
     {
         enum sp_return ret;
 
         // get serial port
-        ret = sp_get_port_by_name(path, &serialport);
+        ret = sp_get_port_by_name(path_, &port);
         if (ret != SP_OK)
         {
-            fprintf(stderr, "%s failed, cannot get serial port for device '%s'\n", __func__, path);
+            fprintf(stderr, "%s failed, cannot get serial port for device '%s'\n", __func__, path_);
+            port = nullptr;
             return;
         }
 
         // open serial port
-        ret = sp_open(serialport, SP_MODE_READ_WRITE);
+        ret = sp_open(port, SP_MODE_READ_WRITE);
         if (ret != SP_OK)
         {
-            fprintf(stderr, "%s failed, cannot open serial port for device '%s'\n", __func__, path);
-            sp_free_port(serialport);
-            serialport = nullptr;
+            fprintf(stderr, "%s failed, cannot open serial port for device '%s'\n", __func__, path_);
+            sp_free_port(port);
+            port = nullptr;
             return;
         }
 
         // disable XON/XOFF flow control
-        sp_set_xon_xoff(serialport, SP_XONXOFF_DISABLED);
+        sp_set_xon_xoff(port, SP_XONXOFF_DISABLED);
 
         // configure serial port
-        sp_set_baudrate(serialport, baudrate);
+        sp_set_baudrate(port, baudrate);
+
+        pthread_mutex_init(&ledLock, nullptr);
+    }
+
+    ~SerialPort()
+    {
+        if (port == nullptr)
+            return;
+
+        pthread_mutex_destroy(&ledLock);
+
+        sp_close(port);
+        sp_free_port(port);
+    }
+};
 
-        pthread_mutex_init(&lock, nullptr);
+std::vector<SerialPort*> SerialPort::registry;
+pthread_mutex_t SerialPort::registryLock = PTHREAD_MUTEX_INITIALIZER;
 
-        thread.running = true;
-        if (pthread_create(&thread.handle, nullptr, _run, this) != 0)
-            thread.running = false;
+// --------------------------------------------------------------------------------------------------------------------
+
+struct LibSerialPort : EventInput,
+                       EventReactor::Handler {
+    EventReactor* const reactor;
+    SerialPort* serialport = nullptr;
+    int fd = -1;
+
+    // live state, only accessed by the reactor thread except for tap-tempo flags
+    ActuatorTable actuators;
+
+    // encoder acceleration, only used by the reactor thread
+    EncoderAccelerator accelerator;
+
+    // rotations parsed from the current read, merged per encoder while going in the same direction,
+    // only used by the reactor thread
+    struct Rotation {
+        int32_t delta;
+        uint64_t time;
+    };
+    std::vector<Rotation> rotations;
+    // amount of encoders with a rotation waiting to be flushed
+    uint32_t pendingRotations = 0;
+
+    // whether reading is paused until the poll thread catches up, only used by the reactor thread
+    bool paused = false;
+
+    RingBuffer<Event, EVENT_BRIDGE_QUEUE_SIZE> events;
+    uint32_t lastOverflowCount = 0;
+
+    // request from poll thread for the reactor thread to reset its state
+    std::atomic<bool> clearRequested { false };
+
+    // protocol spoken by the device, detected from incoming data, only used by the reactor thread
+    SerialProtocol protocol = kSerialProtocolDetect;
+
+    // mapping of device timestamps in binary frames to our own time, only used by the reactor thread
+    struct DeviceClock {
+        // device time of last frame, extended to 64 bits
+        uint64_t deviceTime = 0;
+        // time of last frame
+        uint64_t lastTime = 0;
+        // offset from device time to our own
+        int64_t offset = 0;
+
+        uint64_t map(const uint32_t time24, const uint64_t now) noexcept
+        {
+            // too long since the last frame to know how many times the device clock wrapped, start over
+            if (lastTime == 0 || now - lastTime >= kFrameTimeWrap / 2)
+            {
+                deviceTime = time24;
+                offset = now - time24;
+            }
+            else
+            {
+                deviceTime += (time24 - deviceTime) & (kFrameTimeWrap - 1);
+            }
+
+            lastTime = now;
+
+            // frames are never from the future, and only arrive so late when clocks drift apart
+            const uint64_t time = deviceTime + offset;
+
+            if (time > now)
+            {
+                offset -= time - now;
+                return now;
+            }
+
+            if (now - time > kFrameMaxLatency)
+            {
+                offset += now - time - kFrameMaxLatency;
+                return now - kFrameMaxLatency;
+            }
+
+            return time;
+        }
+    } deviceClock;
+
+    // incoming data not parsed yet, only used by the reactor thread
+    char rx[4096];
+    uint32_t rxSize = 0;
+    // ignore data until the first newline, as we might have opened the port in the middle of a message
+    bool synced = false;
+
+    // amount of malformed messages dropped, written by the reactor thread
+    std::atomic<uint32_t> malformedCount { 0 };
+    uint32_t lastMalformedCount = 0;
+
+    // whether new events were queued since last notify, only used by the reactor thread
+    bool notifyPending = false;
+
+    LibSerialPort(EventReactor* const reactor_,
+                  const EventActuators& actuators_,
+                  const char* const path,
+                  const EventEncoderSettings& encoders)
+        : reactor(reactor_),
+          actuators(actuators_),
+          accelerator(actuators_.numEncoders),
+          rotations(actuators_.numEncoders)
+    {
+        if (encoders.accelerations != nullptr)
+        {
+            for (uint8_t i = 0; i < actuators_.numEncoders; ++i)
+                accelerator.setCurve(i, encoders.accelerations[i]);
+        }
+
+        serialport = SerialPort::acquire(path);
+        if (serialport == nullptr)
+            return;
+
+        if (sp_get_port_handle(serialport->port, &fd) == SP_OK)
+            reactor->addFD(fd, EPOLLIN, this);
+        else
+            fprintf(stderr, "%s failed, cannot get file descriptor for device '%s'\n", __func__, path);
     }
 
     ~LibSerialPort() override
@@ -105,288 +395,543 @@ struct LibSerialPort : EventInput {
         if (serialport == nullptr)
             return;
 
-        if (thread.running)
-        {
-            thread.running = false;
-            pthread_join(thread.handle, nullptr);
-        }
+        if (fd != -1 && ! paused)
+            reactor->removeFD(fd);
 
-        pthread_mutex_destroy(&lock);
+        reactor->cancelTimers(this);
 
-        sp_close(serialport);
-        sp_free_port(serialport);
+        SerialPort::release(serialport);
     }
 
     void clear() override
     {
-        pthread_mutex_lock(&lock);
+        // reactor thread resets its own state, we only drop what is already queued
+        clearRequested.store(true, std::memory_order_release);
+        events.clear();
+    }
+
+    void enableTapTempo(const uint16_t slot, const bool enable) override
+    {
+        if (slot >= actuators.numEncoders)
+            return;
+
+        actuators.tapEnabled[slot].store(enable, std::memory_order_relaxed);
+        actuators.tapReset[slot].store(true, std::memory_order_release);
+    }
+
+    void setEncoderAcceleration(const uint8_t index, const EncoderAcceleration& accel) override
+    {
+        accelerator.setCurve(index, accel);
+    }
+
+    void poll(Callback* const cb) override
+    {
+        Event batch[32];
+
+        for (uint32_t count; (count = events.pop(batch, sizeof(batch)/sizeof(batch[0]))) != 0;)
+            cb->events(batch, count);
 
-        for (int i = 0; i < sizeof(state)/sizeof(state[0]); ++i)
+        const uint32_t overflowCount = events.getOverflowCount();
+
+        if (lastOverflowCount != overflowCount)
         {
-            state[i].time = 0;
-            state[i].state = kEventStateReleased;
-            state[i].changed = false;
-            state[i].value = 0;
+            fprintf(stderr, "Serial event queue overflow, %u events dropped\n", overflowCount - lastOverflowCount);
+            lastOverflowCount = overflowCount;
         }
 
-        for (int i = 0; i < sizeof(tapTempo)/sizeof(tapTempo[0]); ++i)
+        const uint32_t malformed = malformedCount.load(std::memory_order_relaxed);
+
+        if (lastMalformedCount != malformed)
         {
-            tapTempo[i].time = 0;
-            tapTempo[i].value = 0;
-            tapTempo[i].enabled = false;
-            tapTempo[i].updated = false;
+            fprintf(stderr, "Serial input: %u malformed messages dropped\n", malformed - lastMalformedCount);
+            lastMalformedCount = malformed;
         }
+    }
 
-        pthread_mutex_unlock(&lock);
+    void fdReady(int, uint32_t) override
+    {
+        handleClearRequest();
+        readSerialData();
+        flushNotify();
     }
 
-    void enableTapTempo(const uint8_t index, const bool enable) override
+    // long-press deadline reached, timer id is the actuator slot, or the encoder count to resume reading
+    void timerExpired(const uint32_t slot, const uint64_t deadline) override
     {
-        if (index >= NUM_ENCODERS)
+        handleClearRequest();
+
+        if (slot == actuators.numEncoders)
+        {
+            if (paused)
+                resumeReading();
+
+            flushNotify();
             return;
+        }
 
-        pthread_mutex_lock(&lock);
+        // state might have been cleared or released meanwhile
+        if (actuators.state[slot] == kEventStatePressed
+            && actuators.pressTime[slot] + EVENT_BRIDGE_LONG_PRESS_TIME * 1000 == deadline)
+        {
+            actuators.pressTime[slot] = 0;
+            actuators.state[slot] = kEventStateLongPressed;
+            queueEvent(slot, kEventStateLongPressed, 0, deadline);
+        }
 
-        tapTempo[index].time = 0;
-        tapTempo[index].value = 0;
-        tapTempo[index].enabled = enable;
-        tapTempo[index].updated = false;
+        flushNotify();
+    }
 
-        pthread_mutex_unlock(&lock);
+private:
+    void flushNotify()
+    {
+        if (notifyPending)
+        {
+            notifyPending = false;
+            notify();
+        }
     }
 
-    void poll(Callback* const cb) override
+    void handleClearRequest()
     {
-        if (! thread.running)
-            readSerialData(1);
+        if (! clearRequested.exchange(false, std::memory_order_acquire))
+            return;
 
-        copy2();
+        reactor->cancelTimers(this);
+        actuators.reset();
+        accelerator.reset();
 
-        for (int i = 0; i < sizeof(state2)/sizeof(state2[0]); ++i)
-        {
-            if (! state2[i].changed)
-                continue;
+        for (Rotation& rotation : rotations)
+            rotation = {};
 
-            state2[i].changed = false;
+        pendingRotations = 0;
 
-            if (i < NUM_ENCODERS)
-                cb->event(kEventTypeEncoder, state2[i].state, i, state2[i].value);
-            else
-                cb->event(kEventTypeFootswitch, state2[i].state, i - NUM_ENCODERS, state2[i].value);
-        }
+        // the queue was just emptied
+        if (paused)
+            resumeReading();
+    }
 
-        for (int i = 0; i < sizeof(tapTempo2)/sizeof(tapTempo2[0]); ++i)
+    // drain everything available, parsing all complete messages as they come in
+    // pauses reading while the event queue is close to full, so events are never dropped
+    void readSerialData()
+    {
+        for (;;)
         {
-            if (! tapTempo2[i].updated)
-                continue;
+            if (! parseData())
+            {
+                pauseReading();
+                return;
+            }
+
+            const int ret = sp_nonblocking_read(serialport->port, rx + rxSize, sizeof(rx) - rxSize);
+            if (ret <= 0)
+                return;
 
-            tapTempo2[i].updated = false;
+            rxSize += ret;
 
-            if (i < NUM_ENCODERS)
-                cb->event(kEventTypeEncoder, kEventStateTapTempo, i, tapTempo2[i].value * 1000);
-            else
-                cb->event(kEventTypeFootswitch, kEventStateTapTempo, i - NUM_ENCODERS, tapTempo2[i].value * 1000);
+            if (protocol == kSerialProtocolDetect)
+                detectProtocol();
         }
     }
 
-private:
-    void copy2()
+    // parse all complete messages in the receive buffer, returns false if stopped early for lack of queue space
+    bool parseData()
     {
-        pthread_mutex_lock(&lock);
+        const uint64_t time = EventTimeUs();
+        uint32_t consumed = 0;
+        uint32_t malformed = 0;
 
-        for (int i = 0; i < sizeof(state)/sizeof(state[0]); ++i)
+        switch (protocol)
         {
-            if (state[i].changed)
-            {
-                state2[i] = state[i];
-                state[i].changed = false;
-                state[i].value = 0;
-            }
+        case kSerialProtocolDetect:
+            // keep the most recent data around until we know what we are dealing with
+            consumed = rxSize == sizeof(rx) ? rxSize / 2 : 0;
+            break;
+        case kSerialProtocolText:
+            consumed = parseMessages(time, malformed);
+            break;
+        case kSerialProtocolBinary:
+            consumed = parseFrames(time, malformed);
+            break;
         }
 
-        for (int i = 0; i < sizeof(tapTempo)/sizeof(tapTempo[0]); ++i)
+        flushRotations();
+
+        const bool stopped = ! hasQueueSpace();
+
+        rxSize -= consumed;
+
+        if (rxSize == sizeof(rx) && ! stopped)
         {
-            if (tapTempo[i].updated)
-            {
-                tapTempo2[i] = tapTempo[i];
-                tapTempo[i].updated = false;
-            }
+            // no complete message in a full buffer, drop it and wait for the next one to sync up again
+            rxSize = 0;
+            synced = false;
+            ++malformed;
+        }
+        else if (rxSize != 0 && consumed != 0)
+        {
+            std::memmove(rx, rx + consumed, rxSize);
         }
 
-        pthread_mutex_unlock(&lock);
+        if (malformed != 0)
+            malformedCount.fetch_add(malformed, std::memory_order_relaxed);
+
+        return ! stopped;
     }
 
-    static void* _run(void* const arg)
+    // whether the next message fits in the event queue, along with every rotation waiting to be flushed
+    // a single message queues at most 3 events: a flushed rotation, a press and a tap-tempo update
+    bool hasQueueSpace() const noexcept
     {
-        static_cast<LibSerialPort*>(arg)->run();
-        return nullptr;
+        return events.getWriteSpace() >= pendingRotations + 3;
     }
 
-    void run()
+    // stop reading until the poll thread catches up, resuming on a timer
+    void pauseReading()
     {
-        static constexpr const uint32_t timeoutMs = 100;
+        if (paused)
+            return;
 
-        while (thread.running)
-            readSerialData(timeoutMs);
+        paused = true;
+        reactor->removeFD(fd);
+        reactor->armTimer(this, actuators.numEncoders, EventTimeUs() + kResumeInterval);
     }
 
-    void readSerialData(const uint32_t timeoutMs)
+    void resumeReading()
     {
-        int ret;
-        unsigned int offs = 0;
-        char buf[0xff];
+        paused = false;
+        reactor->addFD(fd, EPOLLIN, this);
+        readSerialData();
+    }
 
-        ret = sp_blocking_read(serialport, buf, 2, timeoutMs);
+    // pick the protocol based on the first recognizable messages
+    // text messages never contain the binary sync byte, so two valid frames in a row mean binary protocol
+    void detectProtocol()
+    {
+        const uint8_t* const data = reinterpret_cast<const uint8_t*>(rx);
 
-        if (ret <= 0)
+        for (uint32_t i = 0; i + kFrameSize * 2 <= rxSize; ++i)
         {
-            updateLongPresses();
-            return;
+            if (isFrame(data + i) && isFrame(data + i + kFrameSize))
+            {
+                protocol = kSerialProtocolBinary;
+                serialport->protocol.store(protocol, std::memory_order_relaxed);
+                return;
+            }
         }
 
-        // shift by 1 byte if message starts with a newline
-        if (ret == 2 && buf[0] == '\n' && buf[1] != '\n')
+        // any complete line after the first newline, made of plain ASCII and looking like a message
+        const char* const end = rx + rxSize;
+        const char* nl = static_cast<const char*>(std::memchr(rx, '\n', rxSize));
+
+        while (nl != nullptr)
         {
-            buf[0] = buf[1];
-            --ret;
+            const char* const line = nl + 1;
+            nl = static_cast<const char*>(std::memchr(line, '\n', end - line));
+
+            if (nl == nullptr || nl - line < 3 || line[1] != ' ')
+                continue;
+
+            const char* c = line;
+            while (c != nl && static_cast<uint8_t>(*c) < 0x80)
+                ++c;
+
+            if (c == nl)
+            {
+                protocol = kSerialProtocolText;
+                serialport->protocol.store(protocol, std::memory_order_relaxed);
+                return;
+            }
         }
+    }
+
+    static bool isFrame(const uint8_t* const data) noexcept
+    {
+        return data[0] == kFrameSync && crc8(data, kFrameSize - 1) == data[kFrameSize - 1];
+    }
 
-        // message was read in full, likely starting up and caught unflushed messages, we can stop here
-        if (ret == 2 && buf[1] == '\n')
+    // a cut frame followed by a valid one can pass the CRC check by chance, in which case the valid frame starts
+    // within it and the byte after it is not a sync byte. prefer the overlapping frame if there is one.
+    bool isOverlapped(const uint8_t* const data, const uint32_t pos) const noexcept
+    {
+        if (pos + kFrameSize == rxSize || data[pos + kFrameSize] == kFrameSync)
+            return false;
+
+        for (uint32_t i = pos + 1; i < pos + kFrameSize && i + kFrameSize <= rxSize; ++i)
         {
-            updateLongPresses();
-            return;
+            if (isFrame(data + i))
+                return true;
         }
 
-        for (offs = ret; offs < sizeof(buf); ++offs)
+        return false;
+    }
+
+    // parse all complete lines in the buffer in place
+    // returns the amount of bytes consumed, any partial line is left for the next read
+    uint32_t parseMessages(const uint64_t time, uint32_t& malformed)
+    {
+        char* start = rx;
+        char* const end = rx + rxSize;
+
+        for (char* nl; hasQueueSpace() && (nl = static_cast<char*>(std::memchr(start, '\n', end - start))) != nullptr;
+             start = nl + 1)
         {
-            ret = sp_blocking_read(serialport, buf + offs, 1, timeoutMs);
-            if (ret != 1)
+            if (! synced)
             {
-                updateLongPresses();
-                return;
+                synced = true;
+                continue;
             }
 
-            // still reading
-            if (buf[offs] != '\n')
-                continue;
+            *nl = '\0';
 
-            // got full message
-            const char c = buf[0];
+            uint32_t size = nl - start;
 
-            // debugging tests
-            assert(offs >= 3);
-            assert((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
-            assert(buf[1] == ' ');
+            if (size != 0 && start[size - 1] == '\r')
+                start[--size] = '\0';
 
-            uint8_t index;
-            int32_t value;
+            if (size != 0 && ! handleMessage(start, size, time))
+                ++malformed;
+        }
 
-            if (c >= 'A' && c <= 'Z')
-            {
-                assert(buf[2] == '-' || buf[2] == '+');
+        return start - rx;
+    }
 
-                buf[offs] = '\0';
-                index = c - 'A';
-                assert(index < NUM_ENCODERS);
-                value = std::atoi(buf + 2);
+    // parse all complete frames in the buffer, skipping over anything else
+    // returns the amount of bytes consumed, any partial frame is left for the next read
+    uint32_t parseFrames(const uint64_t time, uint32_t& malformed)
+    {
+        const uint8_t* const data = reinterpret_cast<const uint8_t*>(rx);
+        uint32_t pos = 0;
 
-                pthread_mutex_lock(&lock);
+        while (pos + kFrameSize <= rxSize && hasQueueSpace())
+        {
+            if (data[pos] != kFrameSync)
+            {
+                ++pos;
+                continue;
             }
-            else // if (c >= 'a' && c <= 'z')
+
+            // bad frame or sync byte within another frame, try again from the next byte
+            if (! isFrame(data + pos) || isOverlapped(data, pos) || ! handleFrame(data + pos, time))
             {
-                assert(buf[2] == '0' || buf[2] == '1');
+                ++malformed;
+                ++pos;
+                continue;
+            }
+
+            pos += kFrameSize;
+        }
 
-                index = c - 'a';
-                assert(index < NUM_ENCODERS);
-                value = 0;
+        return pos;
+    }
 
-                pthread_mutex_lock(&lock);
+    // handle a single text message
+    // returns false if the message is malformed, in which case it is ignored
+    bool handleMessage(const char* const line, const uint32_t size, const uint64_t time)
+    {
+        if (size < 3 || line[1] != ' ')
+            return false;
 
-                if (buf[2] == '1')
-                {
-                    state[index].time = get_time_ms();
-                    state[index].state = kEventStatePressed;
+        const char c = line[0];
 
-                    if (tapTempo[index].enabled)
-                        updateTapTempo(index);
-                }
-                else
-                {
-                    state[index].time = 0;
-                    state[index].state = kEventStateReleased;
-                }
-            }
+        if (c >= 'A' && c <= 'Z')
+        {
+            if (line[2] != '-' && line[2] != '+')
+                return false;
 
-            state[index].value += value;
-            state[index].changed = true;
+            char* valueEnd = nullptr;
+            const long delta = std::strtol(line + 2, &valueEnd, 10);
+            if (valueEnd != line + size || delta < INT16_MIN || delta > INT16_MAX)
+                return false;
 
-            pthread_mutex_unlock(&lock);
-            break;
+            return handleRotation(c - 'A', delta, time);
+        }
+
+        if (c >= 'a' && c <= 'z')
+        {
+            if (size != 3 || (line[2] != '0' && line[2] != '1'))
+                return false;
+
+            return handleButton(c - 'a', line[2] == '1', time);
         }
 
-        updateLongPresses();
+        return false;
     }
 
-    void updateLongPresses()
+    // handle a single binary frame with a valid CRC
+    // returns false if the frame contents are invalid, in which case it is ignored
+    bool handleFrame(const uint8_t* const frame, const uint64_t now)
     {
-        // only ask for current time as needed
-        uint32_t now = 0;
-
-        pthread_mutex_lock(&lock);
+        const uint8_t type = frame[1] >> 6;
+        const uint8_t index = frame[1] & 0x3f;
+        const int8_t delta = static_cast<int8_t>(frame[2]);
+        const uint32_t deviceTime = frame[3] | frame[4] << 8 | frame[5] << 16;
 
-        for (int i = 0; i < sizeof(state)/sizeof(state[0]); ++i)
+        switch (type)
         {
-            if (state[i].value != kEventStatePressed)
-                continue;
+        case kFrameTypeRotation:
+            return delta != 0 && handleRotation(index, delta, deviceClock.map(deviceTime, now));
+        case kFrameTypeRelease:
+            return delta == 0 && handleButton(index, false, deviceClock.map(deviceTime, now));
+        case kFrameTypePress:
+            return delta == 0 && handleButton(index, true, deviceClock.map(deviceTime, now));
+        }
 
-            if (now == 0)
-                now = get_time_ms();
+        return false;
+    }
 
-            if (now - state[i].time < EVENT_BRIDGE_LONG_PRESS_TIME)
-                continue;
+    bool handleRotation(const uint8_t index, const int32_t detent, const uint64_t time)
+    {
+        if (index >= actuators.numEncoders)
+            return false;
+
+        Rotation& rotation = rotations[index];
+        const int32_t delta = accelerator.apply(index, detent, time);
+
+        // deliver what was pending first when changing direction
+        if (rotation.delta != 0 && (rotation.delta < 0) != (delta < 0))
+            flushRotation(index);
 
-            state[i].time = 0;
-            state[i].state = kEventStateLongPressed;
-            state[i].changed = true;
+        if (rotation.delta == 0)
+            ++pendingRotations;
+
+        rotation.delta += delta;
+        rotation.time = time;
+        return true;
+    }
+
+    bool handleButton(const uint8_t index, const bool pressed, const uint64_t time)
+    {
+        if (index >= actuators.numEncoders)
+            return false;
+
+        // rotations before the button change keep the previous state
+        flushRotation(index);
+
+        if (pressed)
+        {
+            actuators.pressTime[index] = time;
+            actuators.state[index] = kEventStatePressed;
+            reactor->armTimer(this, index, time + EVENT_BRIDGE_LONG_PRESS_TIME * 1000);
+            queueEvent(index, kEventStatePressed, 0, time);
+
+            if (actuators.tapEnabled[index].load(std::memory_order_relaxed)
+                && actuators.updateTapTempo(index, time))
+                queueEvent(index, kEventStateTapTempo, actuators.tapValue[index], time);
+        }
+        else
+        {
+            actuators.pressTime[index] = 0;
+            actuators.state[index] = kEventStateReleased;
+            reactor->cancelTimer(this, index);
+            queueEvent(index, kEventStateReleased, 0, time);
         }
 
-        pthread_mutex_unlock(&lock);
+        return true;
     }
 
-    void updateTapTempo(const uint8_t index)
+    void flushRotation(const uint8_t index)
     {
-        const uint32_t timeMs = state[index].time;
-        const uint32_t last = tapTempo[index].time;
-        tapTempo[index].time = timeMs;
+        Rotation& rotation = rotations[index];
 
-        if (last == 0)
+        if (rotation.delta == 0)
             return;
 
-        uint32_t delta = timeMs - last;
+        queueEvent(index, actuators.state[index], rotation.delta, rotation.time);
+        rotation.delta = 0;
+        --pendingRotations;
+    }
+
+    // deliver rotations merged during the last read
+    void flushRotations()
+    {
+        for (uint8_t i = 0; i < actuators.numEncoders; ++i)
+            flushRotation(i);
+    }
+
+    void queueEvent(const uint8_t index, const EventState state, const int32_t value, const uint64_t time)
+    {
+        events.push({ kEventTypeEncoder, state, index, value, time });
+        notifyPending = true;
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * LED output sent over a serial port, sharing it with an input for the same device if there is one.
+ * The id is the port path followed by ":" and the device LED index, such as "/dev/ttyS1:3".
+ * Writes happen on flush(), sending all LEDs of the port changed since the last flush at once.
+ */
+struct LibSerialPortOutput : EventOutput {
+    SerialPort* serialport = nullptr;
+    uint8_t led = 0;
 
-        if (delta > EVENT_BRIDGE_TAP_TEMPO_TIMEOUT)
+    LibSerialPortOutput(const char* const id)
+    {
+        std::string path(id);
+        const size_t sep = path.rfind(':');
+
+        if (sep == std::string::npos || sep == 0)
         {
-            if (delta - EVENT_BRIDGE_TAP_TEMPO_TIMEOUT_OVERFLOW > EVENT_BRIDGE_TAP_TEMPO_TIMEOUT)
-                return;
+            fprintf(stderr, "Serial output: invalid id '%s', expected 'path:led'\n", id);
+            return;
+        }
+
+        const char* const index = path.c_str() + sep + 1;
+        char* indexEnd = nullptr;
+        const unsigned long value = std::strtoul(index, &indexEnd, 10);
 
-            delta = EVENT_BRIDGE_TAP_TEMPO_TIMEOUT;
+        if (*index < '0' || *index > '9' || *indexEnd != '\0' || value > UINT8_MAX)
+        {
+            fprintf(stderr, "Serial output: invalid LED index in '%s', expected 0 to %d\n", id, UINT8_MAX);
+            return;
         }
 
-        if (abs_delta(tapTempo[index].value, delta) < EVENT_BRIDGE_TAP_TEMPO_HYSTERESIS)
-            tapTempo[index].value = (tapTempo[index].value * 2 + delta) / 3;
-        else
-            tapTempo[index].value = delta;
+        led = value;
+        path.resize(sep);
+        serialport = SerialPort::acquire(path.c_str());
+    }
+
+    ~LibSerialPortOutput() override
+    {
+        if (serialport != nullptr)
+            SerialPort::release(serialport);
+    }
 
-        tapTempo[index].updated = true;
+    void event(const int32_t value) override
+    {
+        if (serialport != nullptr)
+            serialport->setLED(led, value);
+    }
+
+    void flush() override
+    {
+        if (serialport != nullptr)
+            serialport->flushLEDs();
     }
 };
 
 // --------------------------------------------------------------------------------------------------------------------
 
-EventInput* createNewInput_LibSerialPort(const char* const path)
+EventInput* createNewInput_LibSerialPort(EventReactor* const reactor,
+                                         const EventActuators& actuators,
+                                         const char* const path,
+                                         const EventEncoderSettings& encoders)
 {
-    return new LibSerialPort(path);
+    return new LibSerialPort(reactor, actuators, path, encoders);
+}
+
+EventOutput* createNewOutput_LibSerialPort(const char* const id)
+{
+    LibSerialPortOutput* const output = new LibSerialPortOutput(id);
+
+    if (output->serialport == nullptr)
+    {
+        delete output;
+        return nullptr;
+    }
+
+    return output;
 }
 
 // --------------------------------------------------------------------------------------------------------------------
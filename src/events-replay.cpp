@@ -0,0 +1,329 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#include "capture.hpp"
+#include "events.hpp"
+#include "options.hpp"
+#include "ringbuffer.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Replay input, re-injecting events from a capture file written by EventBridge::startCapture().
+ * The file is memory-mapped and played back from its own thread.
+ *
+ * The id is either a path or a comma-separated list of key=value options:
+ *  - path: capture file to play back
+ *  - fast: if non-zero, play back as fast as the consumer allows instead of following the original timing
+ *  - repeat: amount of times to play the whole file, 0 means forever, defaults to 1
+ *
+ * With original timing, events are timestamped with the time they are replayed at, keeping the original intervals.
+ * Backwards jumps in time (from captures of different boots appended together) restart the timeline.
+ * Fast playback timestamps events right before they are queued.
+ * Playback waits for the consumer when the queue is full, so no event is dropped.
+ */
+struct ReplayInput : EventInput {
+    std::string path;
+    bool fast = false;
+    uint32_t repeat = 1;
+
+    void* mapping = MAP_FAILED;
+    size_t mappingSize = 0;
+    const uint8_t* records = nullptr;
+    uint32_t recordSize = 0;
+    size_t numRecords = 0;
+
+    RingBuffer<Event, EVENT_BRIDGE_QUEUE_SIZE> events;
+    uint32_t lastOverflowCount = 0;
+
+    std::atomic<bool> running { false };
+    pthread_t thread = {};
+
+    ReplayInput(const char* const id)
+    {
+        parseOptions(id);
+
+        if (! open())
+            return;
+
+        running.store(true, std::memory_order_release);
+
+        if (pthread_create(&thread, nullptr, _run, this) != 0)
+            running.store(false, std::memory_order_release);
+    }
+
+    ~ReplayInput() override
+    {
+        if (running.exchange(false, std::memory_order_acq_rel))
+            pthread_join(thread, nullptr);
+
+        if (mapping != MAP_FAILED)
+            munmap(mapping, mappingSize);
+    }
+
+    void clear() override
+    {
+        events.clear();
+    }
+
+    void enableTapTempo(uint16_t, bool) override
+    {
+        // tap-tempo events are replayed as captured
+    }
+
+    void poll(Callback* const cb) override
+    {
+        Event batch[32];
+
+        for (uint32_t count; (count = events.pop(batch, sizeof(batch)/sizeof(batch[0]))) != 0;)
+            cb->events(batch, count);
+
+        const uint32_t overflowCount = events.getOverflowCount();
+
+        if (lastOverflowCount != overflowCount)
+        {
+            fprintf(stderr, "Replay event queue overflow, %u events dropped\n", overflowCount - lastOverflowCount);
+            lastOverflowCount = overflowCount;
+        }
+    }
+
+private:
+    void parseOptions(const char* const id)
+    {
+        if (id == nullptr)
+            return;
+
+        // plain path
+        if (std::strchr(id, '=') == nullptr)
+        {
+            path = id;
+            return;
+        }
+
+        for (EventOptions opts(id); opts.read();)
+        {
+            if (opts.is("path"))
+                path.assign(opts.value, opts.valueLength);
+            else if (opts.is("fast"))
+                fast = std::strtoul(opts.value, nullptr, 10) != 0;
+            else if (opts.is("repeat"))
+                repeat = std::strtoul(opts.value, nullptr, 10);
+            else
+                fprintf(stderr, "Replay input: unknown option '%.*s'\n", static_cast<int>(opts.keyLength), opts.key);
+        }
+    }
+
+    bool open()
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            fprintf(stderr, "Replay input: failed to open '%s': %s\n", path.c_str(), std::strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(EventCaptureHeader)))
+        {
+            fprintf(stderr, "Replay input: '%s' is not an event capture\n", path.c_str());
+            ::close(fd);
+            return false;
+        }
+
+        mappingSize = st.st_size;
+        mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (mapping == MAP_FAILED)
+        {
+            fprintf(stderr, "Replay input: failed to map '%s': %s\n", path.c_str(), std::strerror(errno));
+            return false;
+        }
+
+        madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+        const EventCaptureHeader* const header = static_cast<const EventCaptureHeader*>(mapping);
+
+        if (! EventCaptureHeaderValid(*header))
+        {
+            fprintf(stderr, "Replay input: '%s' is not a valid event capture\n", path.c_str());
+            return false;
+        }
+
+        records = static_cast<const uint8_t*>(mapping) + sizeof(EventCaptureHeader);
+        recordSize = header->recordSize;
+        numRecords = (mappingSize - sizeof(EventCaptureHeader)) / recordSize;
+
+        if (numRecords == 0)
+        {
+            fprintf(stderr, "Replay input: '%s' has no events\n", path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    static void* _run(void* const arg)
+    {
+        static_cast<ReplayInput*>(arg)->run();
+        return nullptr;
+    }
+
+    void run()
+    {
+        for (uint32_t i = 0; repeat == 0 || i < repeat; ++i)
+        {
+            if (! (fast ? playFast() : playTimed()))
+                break;
+        }
+    }
+
+    const EventCaptureRecord& recordAt(const size_t index) const noexcept
+    {
+        return *reinterpret_cast<const EventCaptureRecord*>(records + index * recordSize);
+    }
+
+    bool playFast()
+    {
+        for (size_t r = 0; r < numRecords;)
+        {
+            if (! running.load(std::memory_order_acquire))
+                return false;
+
+            // only produce as much as fits so no event is dropped
+            uint32_t amount = events.getWriteSpace();
+
+            if (amount == 0)
+            {
+                sched_yield();
+                continue;
+            }
+
+            if (amount > numRecords - r)
+                amount = numRecords - r;
+
+            const uint64_t now = EventTimeUs();
+
+            for (uint32_t i = 0; i < amount; ++i, ++r)
+            {
+                Event ev = EventCaptureRecordToEvent(recordAt(r));
+                ev.time = now;
+                events.push(ev);
+            }
+
+            notify();
+        }
+
+        return true;
+    }
+
+    bool playTimed()
+    {
+        // offset from capture timeline into our own
+        uint64_t offset = EventTimeUs() - recordAt(0).time;
+        uint64_t last = recordAt(0).time;
+
+        for (size_t r = 0; r < numRecords;)
+        {
+            if (! running.load(std::memory_order_acquire))
+                return false;
+
+            const uint64_t time = recordAt(r).time;
+
+            if (time < last)
+                offset = EventTimeUs() - time;
+
+            last = time;
+
+            // wake up at least every poll interval so we can stop during long pauses
+            const uint64_t deadline = time + offset;
+            const uint64_t maxWait = EventTimeUs() + EVENT_BRIDGE_POLL_INTERVAL * 1000;
+
+            if (deadline > maxWait)
+            {
+                sleepUntil(maxWait);
+                continue;
+            }
+
+            sleepUntil(deadline);
+
+            // queue every event due by now in one go
+            const uint64_t now = EventTimeUs();
+            bool queued = false;
+
+            for (; r < numRecords; ++r)
+            {
+                const EventCaptureRecord& rec = recordAt(r);
+
+                if (rec.time < last || rec.time + offset > now)
+                    break;
+
+                // wait for the consumer instead of dropping events, flushing what we have so far
+                while (events.getWriteSpace() == 0)
+                {
+                    if (! running.load(std::memory_order_acquire))
+                        return false;
+
+                    if (queued)
+                    {
+                        notify();
+                        queued = false;
+                    }
+
+                    sched_yield();
+                }
+
+                Event ev = EventCaptureRecordToEvent(rec);
+                ev.time = rec.time + offset;
+                events.push(ev);
+                queued = true;
+                last = rec.time;
+            }
+
+            if (queued)
+                notify();
+        }
+
+        return true;
+    }
+
+    static void sleepUntil(const uint64_t timeUs) noexcept
+    {
+        timespec ts;
+        ts.tv_sec = timeUs / 1000000;
+        ts.tv_nsec = (timeUs % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+EventInput* createNewInput_Replay(const char* const id)
+{
+    ReplayInput* const input = new ReplayInput(id);
+
+    // open() already reported why
+    if (! input->running.load(std::memory_order_acquire))
+    {
+        delete input;
+        return nullptr;
+    }
+
+    return input;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,217 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#include "events.hpp"
+#include "options.hpp"
+#include "ringbuffer.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include <pthread.h>
+#include <sched.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// events are generated in bursts at this interval, in microseconds
+#define SYNTHETIC_BURST_INTERVAL 1000
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Load-generator input, producing encoder and footswitch events from its own thread.
+ * Meant for measuring throughput and latency of EventBridge and the code receiving its events.
+ *
+ * The id is a comma-separated list of key=value options:
+ *  - rate: events per second, 0 (the default) generates as fast as the consumer allows without dropping events
+ *  - count: total amount of events to generate, 0 (the default) means unlimited
+ *  - encoders: amount of encoders to generate events for, defaults to the bridge actuator configuration
+ *  - footswitches: amount of footswitches to generate events for, defaults to the bridge actuator configuration
+ *
+ * Events are timestamped right before being queued, so that receivers can measure queue latency.
+ */
+struct SyntheticInput : EventInput {
+    uint32_t rate = 0;
+    uint32_t count = 0;
+    uint8_t numEncoders;
+    uint8_t numFootswitches;
+
+    RingBuffer<Event, EVENT_BRIDGE_QUEUE_SIZE> events;
+    uint32_t lastOverflowCount = 0;
+
+    std::atomic<bool> running { false };
+    pthread_t thread = {};
+
+    // generator state, only accessed by the generator thread
+    uint64_t generated = 0;
+    uint16_t next = 0;
+    bool pressed = false;
+
+    SyntheticInput(const EventActuators& actuators, const char* const id)
+        : numEncoders(actuators.numEncoders),
+          numFootswitches(actuators.numFootswitches)
+    {
+        if (id != nullptr)
+            parseOptions(id);
+
+        if (numEncoders + numFootswitches == 0)
+            return;
+
+        running.store(true, std::memory_order_release);
+
+        if (pthread_create(&thread, nullptr, _run, this) != 0)
+            running.store(false, std::memory_order_release);
+    }
+
+    ~SyntheticInput() override
+    {
+        if (running.exchange(false, std::memory_order_acq_rel))
+            pthread_join(thread, nullptr);
+    }
+
+    void clear() override
+    {
+        events.clear();
+    }
+
+    void enableTapTempo(uint16_t, bool) override
+    {
+        // generated events never include tap-tempo
+    }
+
+    void poll(Callback* const cb) override
+    {
+        Event batch[32];
+
+        for (uint32_t n; (n = events.pop(batch, sizeof(batch)/sizeof(batch[0]))) != 0;)
+            cb->events(batch, n);
+
+        const uint32_t overflowCount = events.getOverflowCount();
+
+        if (lastOverflowCount != overflowCount)
+        {
+            fprintf(stderr, "Synthetic event queue overflow, %u events dropped\n", overflowCount - lastOverflowCount);
+            lastOverflowCount = overflowCount;
+        }
+    }
+
+private:
+    void parseOptions(const char* const id)
+    {
+        for (EventOptions opts(id); opts.read();)
+        {
+            const unsigned long value = std::strtoul(opts.value, nullptr, 10);
+
+            if (opts.is("rate"))
+                rate = value;
+            else if (opts.is("count"))
+                count = value;
+            else if (opts.is("encoders"))
+                numEncoders = value > UINT8_MAX ? UINT8_MAX : value;
+            else if (opts.is("footswitches"))
+                numFootswitches = value > UINT8_MAX ? UINT8_MAX : value;
+            else
+                fprintf(stderr, "Synthetic input: unknown option '%.*s'\n", static_cast<int>(opts.keyLength), opts.key);
+        }
+    }
+
+    static void* _run(void* const arg)
+    {
+        static_cast<SyntheticInput*>(arg)->run();
+        return nullptr;
+    }
+
+    void run()
+    {
+        const uint64_t start = EventTimeUs();
+        uint64_t burst = start;
+
+        while (running.load(std::memory_order_acquire))
+        {
+            if (count != 0 && generated >= count)
+                break;
+
+            uint64_t amount;
+
+            if (rate != 0)
+            {
+                // catch up with where we should be by now, so oversleeping does not lower the rate
+                burst += SYNTHETIC_BURST_INTERVAL;
+                sleepUntil(burst);
+
+                amount = (burst - start) * rate / 1000000 - generated;
+            }
+            else
+            {
+                // unpaced, only produce as much as fits so no event is dropped
+                amount = events.getWriteSpace();
+
+                if (amount == 0)
+                {
+                    sched_yield();
+                    continue;
+                }
+            }
+
+            if (count != 0 && amount > count - generated)
+                amount = count - generated;
+
+            for (uint64_t i = 0; i < amount; ++i)
+                events.push(generate());
+
+            generated += amount;
+
+            if (amount != 0)
+                notify();
+        }
+    }
+
+    // cycle through all actuators, encoders alternate direction and footswitches alternate press/release
+    Event generate() noexcept
+    {
+        Event ev;
+
+        if (next < numEncoders)
+        {
+            ev.etype = kEventTypeEncoder;
+            ev.state = kEventStateReleased;
+            ev.index = next;
+            ev.value = pressed ? -1 : 1;
+        }
+        else
+        {
+            ev.etype = kEventTypeFootswitch;
+            ev.state = pressed ? kEventStateReleased : kEventStatePressed;
+            ev.index = next - numEncoders;
+            ev.value = 0;
+        }
+
+        if (++next == numEncoders + numFootswitches)
+        {
+            next = 0;
+            pressed = ! pressed;
+        }
+
+        ev.time = EventTimeUs();
+        return ev;
+    }
+
+    static void sleepUntil(const uint64_t timeUs) noexcept
+    {
+        timespec ts;
+        ts.tv_sec = timeUs / 1000000;
+        ts.tv_nsec = (timeUs % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+EventInput* createNewInput_Synthetic(const EventActuators& actuators, const char* const id)
+{
+    return new SyntheticInput(actuators, id);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -1,12 +1,16 @@
-// SPDX-FileCopyrightText: 2024 Filipe Coelho <falktx@darkglass.com>
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
 // SPDX-License-Identifier: ISC
 
 #include "event-bridge.hpp"
 #include "events.hpp"
 
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 // --------------------------------------------------------------------------------------------------------------------
 
 enum LED {
@@ -20,33 +24,101 @@ static constexpr const char* kColors[kNumLEDs] = {
     "red", "green", "blue",
 };
 
+// maximum amount of channels in a multicolor LED we can handle
+static constexpr const int kMaxMultiChannels = 8;
+
+// build the path of a sysfs LED file, ids starting with '/' are used as paths instead of names in /sys/class/leds
+static void ledPath(char* const path, const size_t size, const char* const id, const char* const suffix)
+{
+    if (id[0] == '/')
+        std::snprintf(path, size, "%s%s", id, suffix);
+    else
+        std::snprintf(path, size, "/sys/class/leds/%s%s", id, suffix);
+}
+
+static int readMaxBrightness(const char* const path)
+{
+    int maxBrightness = 0;
+
+    if (FILE* const file = std::fopen(path, "r"))
+    {
+        if (std::fscanf(file, "%d", &maxBrightness) != 1)
+            maxBrightness = 0;
+
+        std::fclose(file);
+    }
+
+    return maxBrightness;
+}
+
+/**
+ * Mapping of 8-bit values to the brightness range of a LED, with gamma applied.
+ * Keeps the decimal text of each level, so writes need no formatting.
+ */
+struct BrightnessTable {
+    char text[256][12];
+    uint8_t length[256];
+
+    void init(const int maxBrightness) noexcept
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            const double level = std::pow(i / 255.0, EVENT_BRIDGE_LED_GAMMA) * maxBrightness;
+            length[i] = std::snprintf(text[i], sizeof(text[i]), "%d", static_cast<int>(level + 0.5));
+        }
+    }
+};
+
+/**
+ * RGB LED output using the kernel LED class.
+ * Multicolor LEDs (with a multi_intensity file) are updated with a single write per color change,
+ * otherwise the separate "<id>:red", "<id>:green" and "<id>:blue" LEDs are written one by one.
+ */
 struct SysfsLED : EventOutput {
-    FILE* files[kNumLEDs] = {};
+    int fds[kNumLEDs] = { -1, -1, -1 };
     int lastValues[kNumLEDs] = {};
-    int maxBrightness[kNumLEDs] = {};
+    BrightnessTable tables[kNumLEDs];
+
+    // multicolor LED, -1 if using separate LEDs
+    int multifd = -1;
+    int numMultiChannels = 0;
+    // color of each multi_intensity entry, in multi_index order, kNumLEDs for colors we do not drive
+    uint8_t multiColors[kMaxMultiChannels] = {};
+    int32_t lastMultiValue = 0;
 
     SysfsLED(const char* const id)
     {
+        if (initMultiLED(id))
+            return;
+
         for (int i = 0; i < kNumLEDs; ++i)
             initLED(id, i);
     }
 
     ~SysfsLED() override
     {
+        if (multifd != -1)
+            close(multifd);
+
         for (int i = 0; i < kNumLEDs; ++i)
         {
-            if (files[i] != nullptr)
-                std::fclose(files[i]);
+            if (fds[i] != -1)
+                close(fds[i]);
         }
     }
 
     void event(const int32_t value) override
     {
+        if (multifd != -1)
+        {
+            eventMulti(value);
+            return;
+        }
+
         const uint8_t r = (value >> 16) & 0xff;
         const uint8_t g = (value >> 8) & 0xff;
         const uint8_t b =  value & 0xff;
         const int values[kNumLEDs] = { r, g, b };
-        char svalue[12] = {};
 
         for (int i = 0; i < kNumLEDs; ++i)
         {
@@ -55,53 +127,137 @@ struct SysfsLED : EventOutput {
 
             lastValues[i] = values[i];
 
-            if (files[i] != nullptr)
-            {
-                const int ivalue = maxBrightness[i] == 0xff
-                                 ? values[i]
-                                 : static_cast<float>(values[i]) / 0xff * maxBrightness[i];
-                std::snprintf(svalue, sizeof(svalue) - 1, "%d", ivalue);
-
-                std::fseek(files[i], 0, SEEK_SET);
-                std::fwrite(svalue, std::strlen(svalue) + 1, 1, files[i]);
-                std::fflush(files[i]);
-            }
+            if (fds[i] != -1)
+                pwrite(fds[i], tables[i].text[values[i]], tables[i].length[values[i]], 0);
         }
     }
 
 private:
-    void initLED(const char* const id, const int ledn)
+    void eventMulti(const int32_t value)
     {
-        const char* const color = kColors[ledn];
-        char path[48] = {};
+        if (lastMultiValue == value)
+            return;
 
-        std::snprintf(path, sizeof(path) - 1, "/sys/class/leds/%s:%s/max_brightness", id, color);
-        if (FILE* const file = std::fopen(path, "r"))
+        const BrightnessTable& table = tables[0];
+        const uint8_t values[kNumLEDs + 1] = {
+            static_cast<uint8_t>((value >> 16) & 0xff),
+            static_cast<uint8_t>((value >> 8) & 0xff),
+            static_cast<uint8_t>(value & 0xff),
+            0
+        };
+        char svalue[kMaxMultiChannels * sizeof(table.text[0])];
+        size_t len = 0;
+
+        for (int i = 0; i < numMultiChannels; ++i)
         {
-            std::fseek(file, 0, SEEK_SET);
-            std::fscanf(file, "%d", &maxBrightness[ledn]);
-            std::fclose(file);
+            const uint8_t v = values[multiColors[i]];
 
-            std::snprintf(path, sizeof(path) - 1, "/sys/class/leds/%s:%s/brightness", id, color);
-            files[ledn] = std::fopen(path, "w");
+            if (i != 0)
+                svalue[len++] = ' ';
 
-            // start with minimum brightness
-            if (files[ledn] != nullptr)
-            {
-                const char svalue[] = { '0', '\0' };
-                std::fseek(files[ledn], 0, SEEK_SET);
-                std::fwrite(svalue, sizeof(svalue), 1, files[ledn]);
-                std::fflush(files[ledn]);
-            }
-            else
+            std::memcpy(svalue + len, table.text[v], table.length[v]);
+            len += table.length[v];
+        }
+
+        if (pwrite(multifd, svalue, len, 0) == static_cast<ssize_t>(len))
+            lastMultiValue = value;
+    }
+
+    bool initMultiLED(const char* const id)
+    {
+        char path[256] = {};
+
+        // channel layout, such as "red green blue"
+        ledPath(path, sizeof(path), id, "/multi_index");
+        if (FILE* const file = std::fopen(path, "r"))
+        {
+            char color[16];
+
+            while (numMultiChannels < kMaxMultiChannels && std::fscanf(file, "%15s", color) == 1)
             {
-                fprintf(stderr, "cannot open LED %s for color %s\n", id, color);
+                uint8_t ledn = kNumLEDs;
+
+                for (uint8_t i = 0; i < kNumLEDs; ++i)
+                {
+                    if (std::strcmp(color, kColors[i]) == 0)
+                    {
+                        ledn = i;
+                        break;
+                    }
+                }
+
+                multiColors[numMultiChannels++] = ledn;
             }
+
+            std::fclose(file);
         }
-        else
+
+        if (numMultiChannels == 0)
+            return false;
+
+        // all channels share the same range
+        ledPath(path, sizeof(path), id, "/max_brightness");
+        const int maxBrightness = readMaxBrightness(path);
+        if (maxBrightness == 0)
+        {
+            fprintf(stderr, "cannot open multicolor LED max_brightness %s, using separate LEDs\n", id);
+            return false;
+        }
+
+        tables[0].init(maxBrightness);
+
+        // channel intensities are scaled by the overall brightness, keep it at maximum
+        ledPath(path, sizeof(path), id, "/brightness");
+        const int fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd != -1)
+        {
+            char svalue[12] = {};
+            const int len = std::snprintf(svalue, sizeof(svalue), "%d", maxBrightness);
+            write(fd, svalue, len);
+            close(fd);
+        }
+
+        ledPath(path, sizeof(path), id, "/multi_intensity");
+        multifd = open(path, O_WRONLY | O_CLOEXEC);
+        if (multifd == -1)
+        {
+            fprintf(stderr, "cannot open multicolor LED %s, using separate LEDs\n", id);
+            return false;
+        }
+
+        // start with minimum brightness
+        lastMultiValue = -1;
+        eventMulti(0);
+        return true;
+    }
+
+    void initLED(const char* const id, const int ledn)
+    {
+        const char* const color = kColors[ledn];
+        char path[256] = {};
+        char suffix[32] = {};
+
+        std::snprintf(suffix, sizeof(suffix) - 1, ":%s/max_brightness", color);
+        ledPath(path, sizeof(path), id, suffix);
+
+        const int maxBrightness = readMaxBrightness(path);
+        if (maxBrightness == 0)
         {
             fprintf(stderr, "cannot open LED max_brightness %s for color %s\n", id, color);
+            return;
         }
+
+        tables[ledn].init(maxBrightness);
+
+        std::snprintf(suffix, sizeof(suffix) - 1, ":%s/brightness", color);
+        ledPath(path, sizeof(path), id, suffix);
+        fds[ledn] = open(path, O_WRONLY | O_CLOEXEC);
+
+        // start with minimum brightness
+        if (fds[ledn] != -1)
+            pwrite(fds[ledn], tables[ledn].text[0], tables[ledn].length[0], 0);
+        else
+            fprintf(stderr, "cannot open LED %s for color %s\n", id, color);
     }
 };
 
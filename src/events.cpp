@@ -4,26 +4,46 @@
 #include "event-bridge.hpp"
 #include "events.hpp"
 
-EventInput* EventInput::createNew(const BackendType type, const char* const id, const uint8_t index)
+#include <cerrno>
+
+#include <unistd.h>
+
+EventInput* EventInput::createNew(const BackendType type,
+                                  EventReactor* const reactor,
+                                  const EventActuators& actuators,
+                                  const char* const id,
+                                  const uint8_t index,
+                                  const EventEncoderSettings& encoders)
 {
+    // only used by the libinput and serial backends, which might not be available
+    (void)encoders;
+
     switch (type)
     {
     case kBackendTypeNull:
         return nullptr;
     case kBackendTypeGPIO:
-        return createNewInput_GPIO(id, index);
+        return createNewInput_GPIO(reactor, actuators, id, index);
     case kBackendTypeLibInput:
        #ifdef HAVE_LIBINPUT
-        return createNewInput_LibInput(id);
+        return createNewInput_LibInput(reactor, actuators, id, encoders);
        #else
         return nullptr;
        #endif
     case kBackendTypeLibSerialPort:
        #ifdef HAVE_LIBSERIALPORT
-        return createNewInput_LibSerialPort(id);
+        return createNewInput_LibSerialPort(reactor, actuators, id, encoders);
        #else
         return nullptr;
        #endif
+    case kBackendTypeGPIOChip:
+        return createNewInput_GPIOChip(reactor, actuators, id, index);
+    case kBackendTypeGPIOBank:
+        return createNewInput_GPIOBank(reactor, actuators, id, index);
+    case kBackendTypeSynthetic:
+        return createNewInput_Synthetic(actuators, id);
+    case kBackendTypeReplay:
+        return createNewInput_Replay(id);
     }
     return nullptr;
 }
@@ -38,6 +58,25 @@ EventOutput* EventOutput::createNew(const BackendType type, const char* const id
         return createNewOutput_GPIO(id);
     case kBackendTypeSysfsLED:
         return createNewOutput_SysfsLED(id);
+    case kBackendTypeGPIOChip:
+        return createNewOutput_GPIOChip(id);
+    case kBackendTypeLibSerialPort:
+       #ifdef HAVE_LIBSERIALPORT
+        return createNewOutput_LibSerialPort(id);
+       #else
+        return nullptr;
+       #endif
     }
     return nullptr;
 }
+
+void EventInput::notify() noexcept
+{
+    const int fd = notifyfd.load(std::memory_order_acquire);
+
+    if (fd == -1)
+        return;
+
+    const uint64_t value = 1;
+    while (write(fd, &value, sizeof(value)) == -1 && errno == EINTR) {}
+}
@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <ctime>
 
 /**
  * Default time in milliseconds for a long-press event.
@@ -37,6 +39,53 @@
 #define EVENT_BRIDGE_TAP_TEMPO_TIMEOUT_OVERFLOW 50
 #endif
 
+/**
+ * Default debounce time in milliseconds for GPIO inputs, 0 to disable.
+ * Kernel debouncing is used when available, otherwise it is done in software.
+ */
+#ifndef EVENT_BRIDGE_GPIO_DEBOUNCE_TIME
+#define EVENT_BRIDGE_GPIO_DEBOUNCE_TIME 5
+#endif
+
+/**
+ * Default window in milliseconds for coalescing encoder rotations, 0 to disable.
+ * The first detent of a rotation is delivered immediately, further detents in the same direction within the window
+ * are merged into a single event with a bigger absolute value.
+ */
+#ifndef EVENT_BRIDGE_ENCODER_COALESCE_TIME
+#define EVENT_BRIDGE_ENCODER_COALESCE_TIME 20
+#endif
+
+/**
+ * Default interval in milliseconds for sampling inputs that cannot signal changes by themselves.
+ */
+#ifndef EVENT_BRIDGE_POLL_INTERVAL
+#define EVENT_BRIDGE_POLL_INTERVAL 50
+#endif
+
+/**
+ * Default size of the event queue used between backend reader threads and poll(), must be a power of 2.
+ * When full, new events are dropped and counted as overflows.
+ */
+#ifndef EVENT_BRIDGE_QUEUE_SIZE
+#define EVENT_BRIDGE_QUEUE_SIZE 256
+#endif
+
+/**
+ * Default gamma applied to LED brightness values, 1.0 for linear output.
+ * Values above 1 make low brightness levels darker, closer to how they are perceived.
+ */
+#ifndef EVENT_BRIDGE_LED_GAMMA
+#define EVENT_BRIDGE_LED_GAMMA 1.0
+#endif
+
+/**
+ * Default interval in milliseconds between updates of LED fades and pulses.
+ */
+#ifndef EVENT_BRIDGE_LED_EFFECT_INTERVAL
+#define EVENT_BRIDGE_LED_EFFECT_INTERVAL 20
+#endif
+
 /**
  * Default number of encoders to use.
  */
@@ -58,6 +107,97 @@
 #define NUM_LEDS 3
 #endif
 
+/**
+ * Number of actuators available on the device, for configuring the bridge at runtime.
+ * Defaults are taken from NUM_ENCODERS, NUM_FOOTSWITCHES and NUM_LEDS.
+ */
+struct EventActuators {
+    uint8_t numEncoders = NUM_ENCODERS;
+    uint8_t numFootswitches = NUM_FOOTSWITCHES;
+    uint8_t numLEDs = NUM_LEDS;
+};
+
+/**
+ * Acceleration curve for encoder rotations, applied by input backends using the time between detents.
+ * Detents further apart than @a slowTime are delivered as-is, detents closer than @a fastTime are multiplied by
+ * @a maxMultiplier, and anything in between follows a curve shaped by @a exponent.
+ * Fractional results are carried over into the next detent, so no rotation is lost.
+ */
+struct EncoderAcceleration {
+    /** Time in milliseconds between detents below which acceleration starts, 0 disables acceleration. */
+    uint16_t slowTime = 0;
+
+    /** Time in milliseconds between detents at which the maximum multiplier is reached. */
+    uint16_t fastTime = 0;
+
+    /** Multiplier applied at full speed, from 1 to 255. */
+    float maxMultiplier = 1.f;
+
+    /** Shape of the curve between slow and fast speeds, 1 is linear, bigger values accelerate later. */
+    float exponent = 1.f;
+};
+
+/**
+ * Encoder settings given to input backends on creation, so they apply from the first event read.
+ * @see EventInput::createNew()
+ */
+struct EventEncoderSettings {
+    /** Window for coalescing encoder rotations in milliseconds, 0 to disable. */
+    uint16_t coalesceTime = EVENT_BRIDGE_ENCODER_COALESCE_TIME;
+
+    /** Acceleration curve of each encoder, as many as EventActuators::numEncoders, nullptr for none. */
+    const EncoderAcceleration* accelerations = nullptr;
+};
+
+/**
+ * The possible LED effect types.
+ * @see LEDEffect
+ */
+enum LEDEffectType : uint8_t {
+    /** No effect, stops the current one keeping the last written value. */
+    kLEDEffectNone = 0,
+    /** Switch between @a to and @a from, spending half a period on each. */
+    kLEDEffectBlink,
+    /** Go from @a from to @a to once, then hold @a to. */
+    kLEDEffectFade,
+    /** Start each period at @a to, go down to @a from and back up again. */
+    kLEDEffectPulse,
+};
+
+/**
+ * The possible LED effect easing curves.
+ */
+enum LEDEffectEasing : uint8_t {
+    /** Constant speed. */
+    kLEDEffectEasingLinear = 0,
+    /** Slow at both ends, faster in the middle. */
+    kLEDEffectEasingInOut,
+};
+
+/**
+ * LED effect, run by EventBridge so clients do not need to stream values.
+ * Values are the same as given to sendEvent(), interpolated separately for each 8-bit channel (e.g. RGB colors).
+ */
+struct LEDEffect {
+    /** Effect type. */
+    LEDEffectType type = kLEDEffectNone;
+
+    /** Easing curve for fades and pulses. */
+    LEDEffectEasing easing = kLEDEffectEasingLinear;
+
+    /** Footswitch index whose tap-tempo value sets the period of blinks and pulses, UINT8_MAX for none. */
+    uint8_t tempoIndex = UINT8_MAX;
+
+    /** Blink and pulse period or fade duration in milliseconds, used for tempo effects until a tempo is tapped. */
+    uint32_t time = 0;
+
+    /** Starting value. */
+    int32_t from = 0;
+
+    /** Target value. */
+    int32_t to = 0;
+};
+
 /**
  * The possible event types, for both receiving and sending.
  * @see EventState
@@ -97,6 +237,37 @@ enum EventState {
     kEventStateTapTempo,
 };
 
+/**
+ * A single received event, as used for batched event delivery.
+ */
+struct Event {
+    /** Event type. */
+    EventType etype;
+
+    /** Event state. */
+    EventState state;
+
+    /** Actuator index. */
+    uint8_t index;
+
+    /** Event value, meaning depends on type and state. */
+    int32_t value;
+
+    /** Monotonic time in microseconds of when the event happened. @see EventTimeUs() */
+    uint64_t time;
+};
+
+/**
+ * Get the current monotonic time in microseconds, the same clock used for event timestamps.
+ */
+static inline
+uint64_t EventTimeUs() noexcept
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
 /**
  * Convenience function to convert an event type to a string.
  */
@@ -137,6 +308,64 @@ const char* EventStateStr(const EventState state)
     return "";
 }
 
+/**
+ * Reactor used by input backends for reading events, owned by EventBridge.
+ * All backends share a single reactor thread which waits on every registered file descriptor using epoll.
+ */
+struct EventReactor {
+    /**
+     * Handler for file descriptor readiness, called from the reactor thread.
+     */
+    struct Handler {
+        /** destructor */
+        virtual ~Handler() {};
+
+        /**
+         * Called from the reactor thread when @a fd is ready, @a events contains the ready epoll event flags.
+         */
+        virtual void fdReady(int fd, uint32_t events) = 0;
+
+        /**
+         * Called from the reactor thread when a timer armed via armTimer() expires.
+         * @a deadline is the time the timer was armed for, in monotonic microseconds.
+         */
+        virtual void timerExpired(uint32_t /* id */, uint64_t /* deadline */) {}
+    };
+
+    /** destructor */
+    virtual ~EventReactor() {};
+
+    /**
+     * Register a file descriptor to be watched for @a events (epoll event flags).
+     */
+    virtual bool addFD(int fd, uint32_t events, Handler* handler) = 0;
+
+    /**
+     * Unregister a previously registered file descriptor.
+     * Must only be called from the reactor thread or while the reactor is not running (e.g. on destruction).
+     */
+    virtual void removeFD(int fd) = 0;
+
+    /**
+     * Arm (or re-arm) timer @a id for @a handler, expiring at @a deadline in monotonic microseconds.
+     * Must only be called from the reactor thread.
+     * @see EventTimeUs()
+     */
+    virtual void armTimer(Handler* handler, uint32_t id, uint64_t deadline) = 0;
+
+    /**
+     * Cancel timer @a id for @a handler, does nothing if not armed.
+     * Must only be called from the reactor thread.
+     */
+    virtual void cancelTimer(Handler* handler, uint32_t id) = 0;
+
+    /**
+     * Cancel all timers for @a handler.
+     * Must only be called from the reactor thread or while the reactor is not running (e.g. on destruction).
+     */
+    virtual void cancelTimers(Handler* handler) = 0;
+};
+
 /**
  * Abstract Event class for receiving events.
  */
@@ -149,6 +378,14 @@ struct EventInput {
         kBackendTypeGPIO,
         kBackendTypeLibInput,
         kBackendTypeLibSerialPort,
+        /** GPIO character-device lines, see events-gpiochip.cpp for the id format. */
+        kBackendTypeGPIOChip,
+        /** Sampled GPIO character-device lines, using the same id format as kBackendTypeGPIOChip. */
+        kBackendTypeGPIOBank,
+        /** Load generator for benchmarking, see events-synthetic.cpp for the options accepted as id. */
+        kBackendTypeSynthetic,
+        /** Playback of event captures, see events-replay.cpp for the options accepted as id. */
+        kBackendTypeReplay,
     };
 
     /**
@@ -160,10 +397,28 @@ struct EventInput {
 
         /**
          * Event trigger function, called when an event is received.
+         * @a time is the monotonic time in microseconds of when the event happened, see EventTimeUs().
+         */
+        virtual void event(EventType etype, EventState evalue, uint8_t index, int32_t value, uint64_t time) = 0;
+
+        /**
+         * Batched event trigger function, called with a contiguous array of received events.
+         * The default implementation calls event() for each one.
          */
-        virtual void event(EventType etype, EventState evalue, uint8_t index, int32_t value) = 0;
+        virtual void events(const Event* const evs, const uint32_t count)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+                event(evs[i].etype, evs[i].state, evs[i].index, evs[i].value, evs[i].time);
+        }
     };
 
+    /**
+     * File descriptor used for signaling when new events are ready, set by EventBridge.
+     * Atomic as it is set after the input is already reading events on the reactor thread.
+     * @see notify()
+     */
+    std::atomic<int> notifyfd { -1 };
+
     /** destructor */
     virtual ~EventInput() {};
 
@@ -173,21 +428,48 @@ struct EventInput {
     virtual void clear() {}
 
     /**
-     * Enable tap-tempo for a specific actuator.
+     * Enable tap-tempo for a specific actuator slot, footswitches coming after encoders.
      */
-    virtual void enableTapTempo(uint8_t index, bool enable) = 0;
+    virtual void enableTapTempo(uint16_t slot, bool enable) = 0;
 
     /**
-     * Event polling function, to be called at regular intervals.
-     * @note this function is very likely to be replaced with an FD-based event polling later on.
+     * Set the window for coalescing encoder rotations, in milliseconds, 0 to disable.
+     * Does nothing for backends that do not coalesce.
+     * @see EVENT_BRIDGE_ENCODER_COALESCE_TIME
+     */
+    virtual void setEncoderCoalesceTime(uint16_t /* timeMs */) {}
+
+    /**
+     * Set the acceleration curve for a specific encoder.
+     * Does nothing for backends that do not handle encoders.
+     */
+    virtual void setEncoderAcceleration(uint8_t /* index */, const EncoderAcceleration& /* accel */) {}
+
+    /**
+     * Event polling function, to be called when notified.
+     * Delivers events previously read by the reactor thread.
      */
     virtual void poll(Callback* cb) = 0;
 
+    /**
+     * Signal that new events are ready to be polled, waking up anyone waiting on the EventBridge poll FD.
+     * Safe to call from any thread, typically called from the reactor thread after queueing events.
+     */
+    void notify() noexcept;
+
     /**
      * Entry point.
      * Creates a new EventInput class for a specified event-handling backend.
+     * The backend registers its file descriptors on @a reactor and reads events from the reactor thread.
+     * @a actuators defines how many actuators the backend should handle,
+     * @a encoders is applied before the backend starts reading events.
      */
-    static EventInput* createNew(BackendType type, const char* id, uint8_t index);
+    static EventInput* createNew(BackendType type,
+                                 EventReactor* reactor,
+                                 const EventActuators& actuators,
+                                 const char* id,
+                                 uint8_t index,
+                                 const EventEncoderSettings& encoders = EventEncoderSettings());
 };
 
 /**
@@ -201,6 +483,10 @@ struct EventOutput {
         kBackendTypeNull,
         kBackendTypeGPIO,
         kBackendTypeSysfsLED,
+        /** Several GPIO character-device lines driven by a single value, see events-gpiochip.cpp. */
+        kBackendTypeGPIOChip,
+        /** LEDs driven by a serial device, sharing the port with its input, see events-libserialport.cpp. */
+        kBackendTypeLibSerialPort,
     };
 
     /** destructor */
@@ -211,6 +497,11 @@ struct EventOutput {
      */
     virtual void event(int32_t value) = 0;
 
+    /**
+     * Called after a group of event() calls, for backends that batch their writes.
+     */
+    virtual void flush() {}
+
     /**
      * Entry point.
      * Creates a new EventOutput class for a specified event-handling backend.
@@ -218,13 +509,27 @@ struct EventOutput {
     static EventOutput* createNew(BackendType type, const char* id);
 };
 
-EventInput* createNewInput_GPIO(const char* id, uint8_t index);
+EventInput* createNewInput_GPIO(EventReactor* reactor, const EventActuators& actuators, const char* id, uint8_t index);
+EventInput* createNewInput_GPIOChip(EventReactor* reactor, const EventActuators& actuators, const char* id, uint8_t index);
+EventInput* createNewInput_GPIOBank(EventReactor* reactor, const EventActuators& actuators, const char* id, uint8_t index);
 #ifdef HAVE_LIBINPUT
-EventInput* createNewInput_LibInput(const char* id);
+EventInput* createNewInput_LibInput(EventReactor* reactor,
+                                   const EventActuators& actuators,
+                                   const char* id,
+                                   const EventEncoderSettings& encoders);
 #endif
 #ifdef HAVE_LIBSERIALPORT
-EventInput* createNewInput_LibSerialPort(const char* path);
+EventInput* createNewInput_LibSerialPort(EventReactor* reactor,
+                                         const EventActuators& actuators,
+                                         const char* path,
+                                         const EventEncoderSettings& encoders);
 #endif
+EventInput* createNewInput_Synthetic(const EventActuators& actuators, const char* id);
+EventInput* createNewInput_Replay(const char* id);
 
 EventOutput* createNewOutput_GPIO(const char* id);
+EventOutput* createNewOutput_GPIOChip(const char* id);
+#ifdef HAVE_LIBSERIALPORT
+EventOutput* createNewOutput_LibSerialPort(const char* id);
+#endif
 EventOutput* createNewOutput_SysfsLED(const char* id);
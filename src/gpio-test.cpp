@@ -0,0 +1,245 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+// GPIO input tests, runnable without GPIO hardware.
+// Usage: event-bridge-gpio-test
+// Drives SwitchEngine through a mock reactor with manually fired timers, checking debounce, long-press, tap-tempo
+// and clear handling, and checks that GPIO inputs failing to request their lines never touch the reactor.
+// Exits with a non-zero status if any check fails.
+
+#include "switches.hpp"
+
+#include <cstdio>
+#include <map>
+#include <utility>
+#include <vector>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// reactor that only records calls, timers are fired manually through advance()
+struct MockReactor : EventReactor {
+    std::map<std::pair<Handler*, uint32_t>, uint64_t> timers;
+    uint32_t calls = 0;
+
+    bool addFD(int, uint32_t, Handler*) override
+    {
+        ++calls;
+        return true;
+    }
+
+    void removeFD(int) override
+    {
+        ++calls;
+    }
+
+    void armTimer(Handler* const handler, const uint32_t id, const uint64_t deadline) override
+    {
+        ++calls;
+        timers[std::make_pair(handler, id)] = deadline;
+    }
+
+    void cancelTimer(Handler* const handler, const uint32_t id) override
+    {
+        ++calls;
+        timers.erase(std::make_pair(handler, id));
+    }
+
+    void cancelTimers(Handler* const handler) override
+    {
+        ++calls;
+
+        for (auto it = timers.begin(); it != timers.end();)
+        {
+            if (it->first.first == handler)
+                it = timers.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    // fire all timers expiring up to @a time, in deadline order
+    void advance(const uint64_t time)
+    {
+        for (;;)
+        {
+            auto next = timers.end();
+
+            for (auto it = timers.begin(); it != timers.end(); ++it)
+            {
+                if (it->second <= time && (next == timers.end() || it->second < next->second))
+                    next = it;
+            }
+
+            if (next == timers.end())
+                return;
+
+            Handler* const handler = next->first.first;
+            const uint32_t id = next->first.second;
+            const uint64_t deadline = next->second;
+            timers.erase(next);
+
+            handler->timerExpired(id, deadline);
+        }
+    }
+};
+
+struct MockInput : EventInput {
+    void enableTapTempo(uint16_t, bool) override {}
+    void poll(Callback*) override {}
+};
+
+struct Collector : EventInput::Callback {
+    std::vector<Event> events;
+
+    void event(const EventType etype,
+               const EventState state,
+               const uint8_t index,
+               const int32_t value,
+               const uint64_t time) override
+    {
+        events.push_back({ etype, state, index, value, time });
+    }
+};
+
+static uint32_t failures = 0;
+
+static void check(const bool ok, const char* const what)
+{
+    if (! ok)
+    {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+// poll @a switches and check that exactly the given states were received, in order
+static void expect(SwitchEngine& switches, const std::vector<EventState>& states, const char* const what)
+{
+    Collector collector;
+    switches.poll(&collector);
+
+    bool ok = collector.events.size() == states.size();
+
+    for (size_t i = 0; ok && i < states.size(); ++i)
+        ok = collector.events[i].etype == kEventTypeFootswitch && collector.events[i].state == states[i];
+
+    check(ok, what);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void testSwitches()
+{
+    static constexpr const uint64_t start = 1000000;
+    static constexpr const uint32_t debounce = 5000;
+
+    MockReactor reactor;
+    MockInput input;
+    EventActuators actuators;
+    actuators.numEncoders = 2;
+    actuators.numFootswitches = 2;
+
+    SwitchEngine switches(&reactor, &input, actuators, 2);
+    switches.setLine(0, 0, debounce);
+    switches.setLine(1, 1, 0);
+
+    switches.initial(0, false, start);
+    switches.initial(1, false, start);
+    expect(switches, { kEventStateReleased, kEventStateReleased }, "initial levels are reported");
+
+    // leading-edge debounce, bounces within the window are ignored
+    switches.changed(0, true, start + 1000);
+    switches.changed(0, false, start + 2000);
+    switches.changed(0, true, start + 3000);
+    switches.flush();
+    expect(switches, { kEventStatePressed }, "press is reported right away, bounces are ignored");
+
+    // level differing at the end of the window is reported then
+    switches.changed(0, false, start + 4000);
+    reactor.advance(start + 1000 + debounce);
+    expect(switches, { kEventStateReleased }, "release within debounce window is reported when it ends");
+
+    // long-press
+    switches.changed(1, true, start + 10000);
+    switches.flush();
+    reactor.advance(start + 10000 + EVENT_BRIDGE_LONG_PRESS_TIME * 1000 - 1);
+    expect(switches, { kEventStatePressed }, "long-press does not trigger early");
+    reactor.advance(start + 10000 + EVENT_BRIDGE_LONG_PRESS_TIME * 1000);
+    expect(switches, { kEventStateLongPressed }, "long-press triggers after EVENT_BRIDGE_LONG_PRESS_TIME");
+    switches.changed(1, false, start + 2000000);
+    switches.flush();
+    expect(switches, { kEventStateReleased }, "release after long-press is reported");
+
+    // tap-tempo, slots are given with footswitches after encoders
+    switches.enableTapTempo(actuators.numEncoders + 1, true);
+    switches.changed(1, true, start + 3000000);
+    switches.changed(1, false, start + 3100000);
+    switches.changed(1, true, start + 3500000);
+    switches.flush();
+    expect(switches,
+           { kEventStatePressed, kEventStateReleased, kEventStatePressed, kEventStateTapTempo },
+           "second tap reports tap-tempo");
+
+    // clear drops pending long-press timers on the next reactor call
+    switches.clear();
+    switches.changed(0, true, start + 3600000);
+    switches.flush();
+    reactor.advance(start + 3600000 + EVENT_BRIDGE_LONG_PRESS_TIME * 1000);
+    expect(switches, { kEventStatePressed, kEventStateLongPressed }, "clear cancels long-press of previous press");
+    check(reactor.timers.size() == 0, "no timers left after long-press and debounce windows expire");
+}
+
+static void testFailedRequests()
+{
+    static const char* const ids[] = {
+        // malformed
+        "gpiochip0",
+        ":1",
+        "gpiochip0:",
+        "gpiochip0:1,",
+        "gpiochip0:x",
+        "gpiochip0:1,1",
+        "gpiochip0:1=99",
+        // not a GPIO chip
+        "/dev/null:1",
+        "/nonexistent/gpiochip:1",
+    };
+
+    EventActuators actuators;
+
+    for (const char* const id : ids)
+    {
+        MockReactor reactor;
+        EventInput* input;
+
+        input = createNewInput_GPIOChip(&reactor, actuators, id, 0);
+        check(input == nullptr, "edge-triggered input fails with invalid id");
+        delete input;
+
+        input = createNewInput_GPIOBank(&reactor, actuators, id, 0);
+        check(input == nullptr, "sampled input fails with invalid id");
+        delete input;
+
+        // failing must not touch the reactor, which belongs to another thread
+        check(reactor.calls == 0, "failed input creation does not touch the reactor");
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main()
+{
+    testSwitches();
+    testFailedRequests();
+
+    if (failures != 0)
+    {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,98 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "events.hpp"
+
+/**
+ * Running LED effect, evaluated by the output worker on every tick.
+ * Blinks and pulses follow the tap-tempo of their tempo footswitch when there is one,
+ * restarting their period on each tap.
+ */
+struct LEDEffectRunner {
+    LEDEffect effect;
+    // time the effect was started at, in microseconds
+    uint64_t start = 0;
+
+    /**
+     * Get the effect value at @a time, given the current tap-tempo @a tempo period and @a tempoTime of the last tap.
+     * @a next is set to the time the value should be evaluated again, 0 if the effect has finished,
+     * or UINT64_MAX if it only changes with a new tempo.
+     */
+    int32_t value(const uint64_t time, const uint32_t tempo, const uint64_t tempoTime, uint64_t& next) const noexcept
+    {
+        const bool tempoSynced = effect.type != kLEDEffectFade && effect.tempoIndex != UINT8_MAX && tempo != 0;
+        const uint64_t period = tempoSynced ? tempo : static_cast<uint64_t>(effect.time) * 1000;
+        const uint64_t base = tempoSynced && tempoTime <= time ? tempoTime : start;
+        const uint64_t elapsed = time - base;
+
+        // wait for a tempo if we do not have a period yet
+        if (period == 0)
+        {
+            next = effect.type == kLEDEffectFade ? 0 : UINT64_MAX;
+            return effect.to;
+        }
+
+        switch (effect.type)
+        {
+        case kLEDEffectNone:
+            break;
+
+        case kLEDEffectBlink:
+        {
+            const uint64_t phase = elapsed % period;
+            next = time - phase + (phase < period / 2 ? period / 2 : period);
+            return phase < period / 2 ? effect.to : effect.from;
+        }
+
+        case kLEDEffectFade:
+            if (elapsed >= period)
+                break;
+
+            next = time + EVENT_BRIDGE_LED_EFFECT_INTERVAL * 1000;
+            return mix(ease(static_cast<float>(elapsed) / period));
+
+        case kLEDEffectPulse:
+        {
+            const float phase = static_cast<float>(elapsed % period) / period;
+            next = time + EVENT_BRIDGE_LED_EFFECT_INTERVAL * 1000;
+            return mix(ease(phase < 0.5f ? 1.f - phase * 2 : phase * 2 - 1.f));
+        }
+        }
+
+        next = 0;
+        return effect.to;
+    }
+
+private:
+    float ease(const float t) const noexcept
+    {
+        switch (effect.easing)
+        {
+        case kLEDEffectEasingLinear:
+            break;
+        case kLEDEffectEasingInOut:
+            return t * t * (3.f - 2.f * t);
+        }
+
+        return t;
+    }
+
+    // interpolate between from and to, separately for each 8-bit channel
+    int32_t mix(const float t) const noexcept
+    {
+        const uint32_t from = static_cast<uint32_t>(effect.from);
+        const uint32_t to = static_cast<uint32_t>(effect.to);
+        uint32_t result = 0;
+
+        for (uint32_t shift = 0; shift < 32; shift += 8)
+        {
+            const float a = (from >> shift) & 0xff;
+            const float b = (to >> shift) & 0xff;
+            result |= static_cast<uint32_t>(a + (b - a) * t + 0.5f) << shift;
+        }
+
+        return static_cast<int32_t>(result);
+    }
+};
@@ -6,10 +6,14 @@
 
 #include <QtCore/QCoreApplication>
 #include <QtCore/QFile>
+#include <QtCore/QJsonArray>
 #include <QtCore/QJsonDocument>
 #include <QtCore/QJsonObject>
+#include <QtCore/QSocketNotifier>
 #include <QtWebSockets/QWebSocket>
 
+#include <vector>
+
 #ifdef HAVE_SYSTEMD
 #include <systemd/sd-daemon.h>
 #endif
@@ -40,6 +44,30 @@ static void copyJsonObjectValue(QJsonObject& dst, const QJsonObject& src)
     }
 }
 
+// --------------------------------------------------------------------------------------------------------------------
+// actuator counts can be overridden at runtime via environment, so the same binary can serve several devices
+
+static uint8_t getEnvCount(const char* const name, const uint8_t fallback)
+{
+    if (const char* const value = std::getenv(name))
+    {
+        const int ivalue = std::atoi(value);
+        if (ivalue >= 0 && ivalue <= UINT8_MAX)
+            return ivalue;
+    }
+
+    return fallback;
+}
+
+static EventActuators getActuators()
+{
+    EventActuators actuators;
+    actuators.numEncoders = getEnvCount("EVENT_BRIDGE_NUM_ENCODERS", NUM_ENCODERS);
+    actuators.numFootswitches = getEnvCount("EVENT_BRIDGE_NUM_FOOTSWITCHES", NUM_FOOTSWITCHES);
+    actuators.numLEDs = getEnvCount("EVENT_BRIDGE_NUM_LEDS", NUM_LEDS);
+    return actuators;
+}
+
 // --------------------------------------------------------------------------------------------------------------------
 
 struct WebSocketEventBridge : QObject,
@@ -50,29 +78,52 @@ struct WebSocketEventBridge : QObject,
     WebSocketServer wsServer;
     bool ok = false;
     bool verboseLogs = false;
+    QSocketNotifier* notifier = nullptr;
     int timerId = 0;
 
     // keep current state in memory
     QJsonObject stateJson;
     struct {
-        struct {
-        } encoders[NUM_ENCODERS];
-        struct {
-        } footswitches[NUM_FOOTSWITCHES];
-        struct {
-        } leds[NUM_LEDS];
+        struct Encoder {
+        };
+        std::vector<Encoder> encoders;
+        struct Footswitch {
+        };
+        std::vector<Footswitch> footswitches;
+        struct LED {
+        };
+        std::vector<LED> leds;
     } current;
 
     WebSocketEventBridge()
-        : bridge(this),
+        : bridge(this, getActuators()),
           wsServer(this)
     {
+        const EventActuators& actuators(bridge.getActuators());
+        current.encoders.resize(actuators.numEncoders);
+        current.footswitches.resize(actuators.numFootswitches);
+        current.leds.resize(actuators.numLEDs);
+
         if (! bridge.last_error.empty())
         {
             fprintf(stderr, "Failed to initialize event stream connection: %s\n", bridge.last_error.c_str());
             return;
         }
 
+        // capture all events for later replay, used for reproducing issues from the field
+        if (const char* const path = std::getenv("EVENT_BRIDGE_CAPTURE"))
+        {
+            if (! bridge.startCapture(path))
+                fprintf(stderr, "Failed to start event capture: %s\n", bridge.last_error.c_str());
+        }
+
+        // play back a previous capture as an extra input, see events-replay.cpp for the accepted options
+        if (const char* const replay = std::getenv("EVENT_BRIDGE_REPLAY"))
+        {
+            if (! bridge.addInput(EventInput::kBackendTypeReplay, replay))
+                fprintf(stderr, "Failed to add event replay: %s\n", bridge.last_error.c_str());
+        }
+
         if (! wsServer.last_error.empty())
         {
             fprintf(stderr, "Failed to initialize websocket server: %s\n", wsServer.last_error.c_str());
@@ -94,7 +145,18 @@ struct WebSocketEventBridge : QObject,
         ok = true;
         stateJson["type"] = "state";
 
-        timerId = startTimer(50);
+        // poll for events as soon as the bridge signals them, fallback to a timer if not possible
+        const int pollfd = bridge.getPollFD();
+
+        if (pollfd != -1)
+        {
+            notifier = new QSocketNotifier(pollfd, QSocketNotifier::Read, this);
+            connect(notifier, &QSocketNotifier::activated, this, [this] { bridge.poll(); });
+        }
+        else
+        {
+            timerId = startTimer(EVENT_BRIDGE_POLL_INTERVAL);
+        }
     }
 
     // handle new websocket connection
@@ -142,6 +204,47 @@ struct WebSocketEventBridge : QObject,
 
             handleStateChanges(msgStateObj);
         }
+        else if (msgObj["type"] == "led-effect")
+        {
+            bool idOk = false;
+            const int id = msgObj["id"].toString().toInt(&idOk);
+
+            if (! idOk || id < 1 || id > bridge.getActuators().numLEDs)
+            {
+                fprintf(stderr, "Invalid LED effect id '%s'\n", msgObj["id"].toString().toUtf8().constData());
+                return;
+            }
+
+            LEDEffect effect;
+            effect.type = effectTypeFromStr(msgObj["effect"].toString());
+
+            // period or duration in milliseconds, only meaningful when starting an effect
+            const int time = msgObj["time"].toInt();
+
+            if (effect.type != kLEDEffectNone && time <= 0)
+            {
+                fprintf(stderr, "Invalid LED effect time %d, must be positive\n", time);
+                return;
+            }
+
+            effect.time = effect.type != kLEDEffectNone ? time : 0;
+            effect.from = msgObj["from"].toInt();
+            effect.to = msgObj["to"].toInt();
+
+            if (msgObj["easing"] == "in-out")
+                effect.easing = kLEDEffectEasingInOut;
+
+            if (msgObj.contains("tempo"))
+            {
+                const int tempo = msgObj["tempo"].toString().toInt();
+
+                if (tempo >= 1 && tempo <= bridge.getActuators().numFootswitches)
+                    effect.tempoIndex = tempo - 1;
+            }
+
+            if (! bridge.setLEDEffect(id - 1, effect))
+                fprintf(stderr, "Failed to set LED effect: %s\n", bridge.last_error.c_str());
+        }
     }
 
     void handleStateChanges(const QJsonObject& stateObj)
@@ -149,10 +252,82 @@ struct WebSocketEventBridge : QObject,
     }
 
 private:
-    void eventReceived(EventType etype, EventState state, uint8_t index, int32_t value) override
+    void eventReceived(EventType etype, EventState state, uint8_t index, int32_t value, uint64_t time) override
+    {
+        printf("eventReceived %d:%s, %d:%s, %u, %d, %llu\n",
+               etype, EventTypeStr(etype), state, EventStateStr(state), index, value,
+               static_cast<unsigned long long>(time));
+    }
+
+    // encode all events from a single poll cycle into one websocket message
+    void eventsReceived(const Event* const events, const uint32_t count) override
+    {
+        QJsonArray eventsJson;
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const Event& ev(events[i]);
+
+            if (verboseLogs)
+                eventReceived(ev.etype, ev.state, ev.index, ev.value, ev.time);
+
+            QJsonObject eventJson;
+            eventJson["actuator"] = actuatorStr(ev.etype);
+            eventJson["id"] = QString::number(ev.index + 1);
+            eventJson["state"] = stateStr(ev.state);
+            eventJson["value"] = ev.value;
+            eventJson["time"] = static_cast<qint64>(ev.time);
+            eventsJson.append(eventJson);
+        }
+
+        QJsonObject msgJson;
+        msgJson["type"] = "events";
+        msgJson["events"] = eventsJson;
+
+        wsServer.sendMessage(QJsonDocument(msgJson).toJson(QJsonDocument::Compact));
+    }
+
+    static const char* actuatorStr(const EventType etype)
+    {
+        switch (etype)
+        {
+        case kEventTypeNull:
+            break;
+        case kEventTypeEncoder:
+            return "encoder";
+        case kEventTypeFootswitch:
+            return "footswitch";
+        case kEventTypeLED:
+            return "led";
+        }
+        return "";
+    }
+
+    static LEDEffectType effectTypeFromStr(const QString& type)
+    {
+        if (type == "blink")
+            return kLEDEffectBlink;
+        if (type == "fade")
+            return kLEDEffectFade;
+        if (type == "pulse")
+            return kLEDEffectPulse;
+        return kLEDEffectNone;
+    }
+
+    static const char* stateStr(const EventState state)
     {
-        printf("eventReceived %d:%s, %d:%s, %u, %d\n",
-               etype, EventTypeStr(etype), state, EventStateStr(state), index, value);
+        switch (state)
+        {
+        case kEventStateReleased:
+            return "released";
+        case kEventStatePressed:
+            return "pressed";
+        case kEventStateLongPressed:
+            return "long-pressed";
+        case kEventStateTapTempo:
+            return "tap-tempo";
+        }
+        return "";
     }
 
     void timerEvent(QTimerEvent* const event) override
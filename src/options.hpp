@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include <cstring>
+
+/**
+ * Iterator over a comma-separated list of key=value options, as used by some input backend ids.
+ * Entries without a '=' are reported with an empty value.
+ */
+struct EventOptions {
+    const char* key = nullptr;
+    size_t keyLength = 0;
+    const char* value = nullptr;
+    size_t valueLength = 0;
+
+    EventOptions(const char* const options) noexcept
+        : next(options != nullptr ? options : "") {}
+
+    /**
+     * Move to the next option, returns false once all options have been read.
+     */
+    bool read() noexcept
+    {
+        if (*next == '\0')
+            return false;
+
+        const char* const sep = std::strchr(next, ',');
+        const size_t length = sep != nullptr ? static_cast<size_t>(sep - next) : std::strlen(next);
+
+        key = next;
+        next = sep != nullptr ? sep + 1 : next + length;
+
+        if (const char* const eq = static_cast<const char*>(std::memchr(key, '=', length)))
+        {
+            keyLength = eq - key;
+            value = eq + 1;
+            valueLength = length - keyLength - 1;
+        }
+        else
+        {
+            keyLength = length;
+            value = key + length;
+            valueLength = 0;
+        }
+
+        return true;
+    }
+
+    /**
+     * Check if the current option key matches @a name.
+     */
+    bool is(const char* const name) const noexcept
+    {
+        return std::strlen(name) == keyLength && std::strncmp(key, name, keyLength) == 0;
+    }
+
+private:
+    const char* next;
+};
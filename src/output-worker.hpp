@@ -0,0 +1,375 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "events.hpp"
+#include "led-effects.hpp"
+#include "ringbuffer.hpp"
+
+#include <atomic>
+#include <vector>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// maximum amount of outputs, each output is queued at most once so this is also the worker queue size
+#define EVENT_BRIDGE_MAX_OUTPUTS 1024
+
+/**
+ * Worker thread for output writes, so that slow drivers never block the thread sending events.
+ * Each output keeps only its latest command (a value or an effect), a burst of updates before the worker gets to it
+ * results in a single write.
+ * LED effects run inside the worker, driven by a timerfd that is only armed while effects need updating.
+ *
+ * send(), sendEffect() and setTempo() are meant for a single thread (the one calling EventBridge::sendEvent),
+ * which is also the one owning the slots.
+ */
+struct OutputWorker {
+    struct Slot {
+        EventOutput* const output;
+        // latest command, packed effect parameters (see sendEffect()) or 0 for a plain value, guarded by seq
+        std::atomic<uint64_t> params { 0 };
+        std::atomic<int32_t> value { 0 };
+        std::atomic<int32_t> value2 { 0 };
+        // odd while the command is being written
+        std::atomic<uint32_t> seq { 0 };
+        // whether the slot is in the worker queue, pending a write
+        std::atomic<bool> queued { false };
+        // whether the output needs a flush, only used by the worker thread
+        bool flushPending = false;
+
+        Slot(EventOutput* const output_) noexcept
+            : output(output_) {}
+    };
+
+    OutputWorker()
+    {
+        runners.reserve(16);
+        written.reserve(16);
+
+        for (uint32_t i = 0; i <= UINT8_MAX; ++i)
+        {
+            tempos[i].store(0, std::memory_order_relaxed);
+            tempoTimes[i].store(0, std::memory_order_relaxed);
+        }
+
+        wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (wakefd == -1 || timerfd == -1)
+            return;
+
+        running.store(true, std::memory_order_release);
+
+        if (pthread_create(&thread, nullptr, _run, this) != 0)
+            running.store(false, std::memory_order_release);
+    }
+
+    ~OutputWorker()
+    {
+        stop();
+
+        if (timerfd != -1)
+            close(timerfd);
+
+        if (wakefd != -1)
+            close(wakefd);
+    }
+
+    /**
+     * Stop the worker thread and any running effects, doing pending writes on the calling thread.
+     * Further calls to send() write synchronously.
+     */
+    void stop()
+    {
+        if (running.exchange(false, std::memory_order_acq_rel))
+        {
+            const uint64_t value = 1;
+            write(wakefd, &value, sizeof(value));
+            pthread_join(thread, nullptr);
+            process(EventTimeUs());
+            flush();
+            runners.clear();
+        }
+    }
+
+    /**
+     * Set the latest value of @a slot and queue it for writing, unless it is already queued.
+     * Stops any effect running on the slot.
+     * Writes synchronously if the worker thread could not be started.
+     */
+    void send(Slot* const slot, const int32_t value)
+    {
+        if (! running.load(std::memory_order_relaxed))
+        {
+            slot->output->event(value);
+            slot->output->flush();
+            return;
+        }
+
+        store(slot, 0, value, 0);
+    }
+
+    /**
+     * Start @a effect on @a slot, replacing any effect or value pending or running on it.
+     * Returns false if effects are not available, as the worker thread could not be started.
+     */
+    bool sendEffect(Slot* const slot, const LEDEffect& effect)
+    {
+        if (! running.load(std::memory_order_relaxed))
+            return false;
+
+        // lowest bit tells effects apart from plain values
+        const uint64_t params = 1
+                              | static_cast<uint64_t>(effect.type) << 8
+                              | static_cast<uint64_t>(effect.easing) << 16
+                              | static_cast<uint64_t>(effect.tempoIndex) << 24
+                              | static_cast<uint64_t>(effect.time) << 32;
+
+        store(slot, params, effect.from, effect.to);
+        return true;
+    }
+
+    /**
+     * Set the tap-tempo @a period of footswitch @a index in microseconds, as last tapped at @a time.
+     * Effects following this footswitch restart their period at @a time.
+     */
+    void setTempo(const uint8_t index, const uint32_t period, const uint64_t time)
+    {
+        tempoTimes[index].store(time, std::memory_order_relaxed);
+        tempos[index].store(period, std::memory_order_relaxed);
+
+        if (running.load(std::memory_order_relaxed))
+            wake();
+    }
+
+private:
+    int wakefd = -1;
+    int timerfd = -1;
+    pthread_t thread = {};
+    std::atomic<bool> running { false };
+    std::atomic<bool> wakePending { false };
+    RingBuffer<Slot*, EVENT_BRIDGE_MAX_OUTPUTS> queue;
+
+    // tap-tempo of each footswitch
+    std::atomic<uint32_t> tempos[UINT8_MAX + 1];
+    std::atomic<uint64_t> tempoTimes[UINT8_MAX + 1];
+
+    // running effects, only accessed by the worker thread
+    struct Runner {
+        Slot* slot;
+        LEDEffectRunner effect;
+        // last written value
+        int32_t value;
+        // time of next update, 0 once finished, UINT64_MAX if waiting for a tempo
+        uint64_t next;
+    };
+    std::vector<Runner> runners;
+    // slots written to during the current cycle, only accessed by the worker thread
+    std::vector<Slot*> written;
+    // currently programmed timer deadline, 0 if disarmed
+    uint64_t deadline = 0;
+
+    // write a new command into the slot and queue it, single writer seqlock
+    void store(Slot* const slot, const uint64_t params, const int32_t value, const int32_t value2)
+    {
+        const uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+        slot->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot->params.store(params, std::memory_order_relaxed);
+        slot->value.store(value, std::memory_order_relaxed);
+        slot->value2.store(value2, std::memory_order_relaxed);
+        slot->seq.store(seq + 2, std::memory_order_release);
+
+        if (slot->queued.exchange(true, std::memory_order_acq_rel))
+            return;
+
+        queue.push(slot);
+        wake();
+    }
+
+    // only wake up the worker once per processing cycle
+    void wake()
+    {
+        if (! wakePending.exchange(true, std::memory_order_acq_rel))
+        {
+            const uint64_t one = 1;
+            write(wakefd, &one, sizeof(one));
+        }
+    }
+
+    static void* _run(void* const arg)
+    {
+        static_cast<OutputWorker*>(arg)->run();
+        return nullptr;
+    }
+
+    void run()
+    {
+        struct pollfd pfds[2] = {
+            { wakefd, POLLIN, 0 },
+            { timerfd, POLLIN, 0 },
+        };
+        uint64_t value;
+
+        while (running.load(std::memory_order_acquire))
+        {
+            if (::poll(pfds, 2, -1) <= 0)
+                continue;
+
+            if (pfds[1].revents & POLLIN)
+                read(timerfd, &value, sizeof(value));
+
+            if (pfds[0].revents & POLLIN)
+            {
+                read(wakefd, &value, sizeof(value));
+
+                // clear before draining, so anything queued from now on wakes us up again
+                wakePending.store(false, std::memory_order_release);
+            }
+
+            const uint64_t now = EventTimeUs();
+            process(now);
+            update(now);
+            flush();
+        }
+    }
+
+    // handle the latest command of every queued slot
+    void process(const uint64_t now)
+    {
+        for (Slot* slot; queue.pop(slot);)
+        {
+            // clear before reading the command, so newer commands queue the slot again
+            slot->queued.exchange(false, std::memory_order_acq_rel);
+
+            uint64_t params;
+            int32_t value, value2;
+
+            for (uint32_t seq;;)
+            {
+                seq = slot->seq.load(std::memory_order_acquire);
+                params = slot->params.load(std::memory_order_relaxed);
+                value = slot->value.load(std::memory_order_relaxed);
+                value2 = slot->value2.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if ((seq & 1) == 0 && seq == slot->seq.load(std::memory_order_relaxed))
+                    break;
+            }
+
+            removeRunner(slot);
+
+            if (params == 0)
+            {
+                writeSlot(slot, value);
+                continue;
+            }
+
+            Runner runner = { slot, {}, 0, now };
+            runner.effect.effect.type = static_cast<LEDEffectType>((params >> 8) & 0xff);
+            runner.effect.effect.easing = static_cast<LEDEffectEasing>((params >> 16) & 0xff);
+            runner.effect.effect.tempoIndex = (params >> 24) & 0xff;
+            runner.effect.effect.time = params >> 32;
+            runner.effect.effect.from = value;
+            runner.effect.effect.to = value2;
+            runner.effect.start = now;
+
+            if (runner.effect.effect.type != kLEDEffectNone)
+                runners.push_back(runner);
+        }
+    }
+
+    // write the current value of effects due by now, and program the timer for the next update
+    void update(const uint64_t now)
+    {
+        uint64_t earliest = UINT64_MAX;
+
+        for (size_t i = 0; i < runners.size();)
+        {
+            Runner& runner = runners[i];
+            const uint8_t tempoIndex = runner.effect.effect.tempoIndex;
+
+            // tempo changes are not timed, so tempo effects are checked on every wake up
+            if (runner.next <= now || tempoIndex != UINT8_MAX)
+            {
+                const bool started = runner.effect.start == now;
+                const int32_t value = runner.effect.value(now,
+                                                          tempos[tempoIndex].load(std::memory_order_relaxed),
+                                                          tempoTimes[tempoIndex].load(std::memory_order_relaxed),
+                                                          runner.next);
+
+                if (started || runner.value != value)
+                {
+                    runner.value = value;
+                    writeSlot(runner.slot, value);
+                }
+            }
+
+            if (runner.next == 0)
+            {
+                runners[i] = runners.back();
+                runners.pop_back();
+                continue;
+            }
+
+            if (runner.next < earliest)
+                earliest = runner.next;
+
+            ++i;
+        }
+
+        if (earliest == UINT64_MAX)
+            earliest = 0;
+
+        if (deadline == earliest)
+            return;
+
+        deadline = earliest;
+
+        struct itimerspec its = {};
+        its.it_value.tv_sec = deadline / 1000000;
+        its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, nullptr);
+    }
+
+    void writeSlot(Slot* const slot, const int32_t value)
+    {
+        slot->output->event(value);
+
+        if (! slot->flushPending)
+        {
+            slot->flushPending = true;
+            written.push_back(slot);
+        }
+    }
+
+    // let outputs that batch their writes send everything written during this cycle
+    void flush()
+    {
+        for (Slot* const slot : written)
+        {
+            slot->flushPending = false;
+            slot->output->flush();
+        }
+
+        written.clear();
+    }
+
+    void removeRunner(Slot* const slot) noexcept
+    {
+        for (size_t i = 0; i < runners.size(); ++i)
+        {
+            if (runners[i].slot == slot)
+            {
+                runners[i] = runners.back();
+                runners.pop_back();
+                return;
+            }
+        }
+    }
+};
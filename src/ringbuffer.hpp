@@ -0,0 +1,107 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Bounded single-producer/single-consumer ring buffer, lock-free and allocation-free.
+ * One thread may call push() while another calls pop(), everything else is consumer-side only.
+ *
+ * Overflow policy is to drop the newest item: when the buffer is full push() returns false and increments the
+ * overflow counter, leaving already queued items untouched so the consumer still sees them in order.
+ */
+template <typename T, uint32_t Size>
+struct RingBuffer {
+    static_assert(Size != 0 && (Size & (Size - 1)) == 0, "RingBuffer size must be a power of 2");
+
+    /**
+     * Push a new item into the buffer, producer-side.
+     * Returns false and increments the overflow counter if the buffer is full.
+     */
+    bool push(const T& item) noexcept
+    {
+        const uint32_t wr = head.load(std::memory_order_relaxed);
+
+        if (wr - tail.load(std::memory_order_acquire) == Size)
+        {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        items[wr & (Size - 1)] = item;
+        head.store(wr + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Get the amount of items that can be pushed before the buffer is full, producer-side.
+     */
+    uint32_t getWriteSpace() const noexcept
+    {
+        return Size - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+    }
+
+    /**
+     * Pop a single item from the buffer, consumer-side.
+     * Returns false if the buffer is empty.
+     */
+    bool pop(T& item) noexcept
+    {
+        const uint32_t rd = tail.load(std::memory_order_relaxed);
+
+        if (rd == head.load(std::memory_order_acquire))
+            return false;
+
+        item = items[rd & (Size - 1)];
+        tail.store(rd + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pop up to @a maxCount items from the buffer into a contiguous array, consumer-side.
+     * Returns the amount of items popped, 0 if the buffer is empty.
+     */
+    uint32_t pop(T* const dst, const uint32_t maxCount) noexcept
+    {
+        const uint32_t rd = tail.load(std::memory_order_relaxed);
+        uint32_t count = head.load(std::memory_order_acquire) - rd;
+
+        if (count > maxCount)
+            count = maxCount;
+
+        for (uint32_t i = 0; i < count; ++i)
+            dst[i] = items[(rd + i) & (Size - 1)];
+
+        tail.store(rd + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * Discard all items currently in the buffer, consumer-side.
+     */
+    void clear() noexcept
+    {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /**
+     * Get the amount of items dropped so far due to the buffer being full.
+     */
+    uint32_t getOverflowCount() const noexcept
+    {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    // head and tail are free-running, wrapping around is handled by unsigned arithmetic
+    // padding keeps producer and consumer indexes on separate cache lines (C++14 new ignores alignas)
+    std::atomic<uint32_t> head { 0 };
+    uint8_t padding1[64 - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> tail { 0 };
+    uint8_t padding2[64 - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> overflows { 0 };
+    T items[Size];
+};
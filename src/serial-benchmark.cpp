@@ -0,0 +1,567 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+// Serial input benchmark, simulating a serial device on a pseudo-terminal and reading it through EventBridge.
+// Usage: event-bridge-serial-benchmark [-t seconds] [options]
+// Options are a comma-separated list of key=value pairs:
+//  - protocol: "text" (the default) or "binary", see events-libserialport.cpp
+//  - rate: messages per second, 0 (the default) sends as fast as the pseudo-terminal allows
+//  - count: total amount of messages to send, defaults to 100000
+//  - encoders: amount of encoders to send messages for, defaults to 4
+//  - buttons: percentage of button messages, the rest are rotations, defaults to 10
+//  - garbage: percentage of garbage and partial messages mixed in, defaults to 0
+//  - seed: random seed, for reproducible runs
+// Rotation deltas are always positive, so lost rotations show up as a difference between sent and received deltas.
+// Button presses and releases are counted separately, long-presses and tap-tempo are reported but not compared.
+// Malformed messages are counted from the reports of the serial input, which are otherwise hidden while running.
+// Without garbage everything must arrive, otherwise a cut frame followed by a valid one can still pass CRC-8 by chance,
+// so up to SERIAL_BENCHMARK_GARBAGE_TOLERANCE mismatched rotation units and button messages are accepted for every
+// 1000 garbage insertions. The exit status is non-zero if more than that went missing or was unexpectedly received.
+
+#include "event-bridge.hpp"
+#include "options.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// messages are sent in bursts at this interval when rate limited, in microseconds
+#define SERIAL_BENCHMARK_BURST_INTERVAL 1000
+#define SERIAL_BENCHMARK_DEFAULT_SECONDS 10
+// stop once no events arrive for this long after everything was sent, in microseconds
+#define SERIAL_BENCHMARK_IDLE_TIMEOUT 1000000
+// accepted mismatches for every 1000 garbage insertions
+#define SERIAL_BENCHMARK_GARBAGE_TOLERANCE 1
+
+// --------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Simulated serial device, writing messages into the master side of a pseudo-terminal from its own thread.
+ */
+struct SerialSimulator {
+    bool binary = false;
+    uint32_t rate = 0;
+    uint32_t count = 100000;
+    uint8_t numEncoders = 4;
+    uint32_t buttons = 10;
+    uint32_t garbage = 0;
+    uint32_t seed = 1;
+
+    int masterfd = -1;
+    int slavefd = -1;
+    char slavePath[64] = {};
+
+    // stop request from the main thread, in case time runs out
+    std::atomic<bool> stopped { false };
+
+    // results, valid once done
+    std::atomic<bool> done { false };
+    uint64_t sentMessages = 0;
+    uint64_t sentRotations = 0;
+    uint64_t sentPresses = 0;
+    uint64_t sentReleases = 0;
+    uint64_t sentGarbage = 0;
+    uint64_t sentBytes = 0;
+    std::vector<int64_t> sentDeltas;
+
+    bool parseOptions(const char* const options)
+    {
+        for (EventOptions opts(options); opts.read();)
+        {
+            if (opts.is("protocol"))
+                binary = opts.valueLength == 6 && std::strncmp(opts.value, "binary", 6) == 0;
+            else if (opts.is("rate"))
+                rate = std::strtoul(opts.value, nullptr, 10);
+            else if (opts.is("count"))
+                count = std::strtoul(opts.value, nullptr, 10);
+            else if (opts.is("encoders"))
+                numEncoders = std::min<unsigned long>(std::strtoul(opts.value, nullptr, 10), UINT8_MAX);
+            else if (opts.is("buttons"))
+                buttons = std::strtoul(opts.value, nullptr, 10);
+            else if (opts.is("garbage"))
+                garbage = std::strtoul(opts.value, nullptr, 10);
+            else if (opts.is("seed"))
+                seed = std::strtoul(opts.value, nullptr, 10);
+            else
+            {
+                fprintf(stderr, "unknown option '%.*s'\n", static_cast<int>(opts.keyLength), opts.key);
+                return false;
+            }
+        }
+
+        // limited by the message format, letters in text mode and 6 bits in binary mode
+        numEncoders = std::max<uint8_t>(1, std::min<uint8_t>(numEncoders, binary ? 64 : 26));
+
+        sentDeltas.resize(numEncoders);
+        return true;
+    }
+
+    bool open()
+    {
+        masterfd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (masterfd == -1 || grantpt(masterfd) != 0 || unlockpt(masterfd) != 0)
+        {
+            fprintf(stderr, "failed to create pseudo-terminal: %s\n", std::strerror(errno));
+            return false;
+        }
+
+        std::snprintf(slavePath, sizeof(slavePath), "%s", ptsname(masterfd));
+
+        // keep the slave side open in raw mode, so data is passed as-is and never hangs up
+        slavefd = ::open(slavePath, O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (slavefd == -1)
+        {
+            fprintf(stderr, "failed to open '%s': %s\n", slavePath, std::strerror(errno));
+            return false;
+        }
+
+        struct termios tio;
+        tcgetattr(slavefd, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slavefd, TCSANOW, &tio);
+        return true;
+    }
+
+    void close()
+    {
+        if (slavefd != -1)
+            ::close(slavefd);
+        if (masterfd != -1)
+            ::close(masterfd);
+    }
+
+    static void* _run(void* const arg)
+    {
+        static_cast<SerialSimulator*>(arg)->run();
+        return nullptr;
+    }
+
+    void run()
+    {
+        std::vector<bool> pressed(numEncoders);
+        std::vector<char> buffer;
+        const uint64_t start = EventTimeUs();
+
+        // a text device starts with a newline, as the parser ignores everything up to the first one
+        if (! binary)
+        {
+            buffer.push_back('\n');
+        }
+
+        // with no rate limit, bursts are as big as the pseudo-terminal buffer usually takes at once
+        const uint32_t burstSize = rate != 0
+                                 ? std::max<uint64_t>(1, static_cast<uint64_t>(rate) * SERIAL_BENCHMARK_BURST_INTERVAL / 1000000)
+                                 : 64;
+
+        while (sentMessages < count && ! stopped.load(std::memory_order_relaxed))
+        {
+
+            for (uint32_t i = 0; i < burstSize && sentMessages < count; ++i)
+            {
+                if (garbage != 0 && random() % 100 < garbage)
+                {
+                    addGarbage(buffer);
+                    ++sentGarbage;
+                }
+
+                const uint8_t index = random() % numEncoders;
+
+                if (random() % 100 < buttons)
+                {
+                    pressed[index] = ! pressed[index];
+                    addButton(buffer, index, pressed[index]);
+                    ++(pressed[index] ? sentPresses : sentReleases);
+                }
+                else
+                {
+                    const int8_t delta = 1 + random() % 3;
+                    sentDeltas[index] += delta;
+                    addRotation(buffer, index, delta);
+                    ++sentRotations;
+                }
+
+                ++sentMessages;
+            }
+
+            if (! writeAll(buffer.data(), buffer.size()))
+                break;
+
+            sentBytes += buffer.size();
+            buffer.clear();
+
+            if (rate != 0)
+                sleepUntil(start + sentMessages * 1000000 / rate);
+        }
+
+        done.store(true, std::memory_order_release);
+    }
+
+private:
+    void addRotation(std::vector<char>& buffer, const uint8_t index, const int8_t delta)
+    {
+        if (binary)
+            return addFrame(buffer, 0, index, delta);
+
+        char msg[16];
+        const int len = std::snprintf(msg, sizeof(msg), "%c %+d\n", 'A' + index, delta);
+        buffer.insert(buffer.end(), msg, msg + len);
+    }
+
+    void addButton(std::vector<char>& buffer, const uint8_t index, const bool press)
+    {
+        if (binary)
+            return addFrame(buffer, press ? 2 : 1, index, 0);
+
+        const char msg[4] = { static_cast<char>('a' + index), ' ', press ? '1' : '0', '\n' };
+        buffer.insert(buffer.end(), msg, msg + sizeof(msg));
+    }
+
+    void addFrame(std::vector<char>& buffer, const uint8_t type, const uint8_t index, const int8_t delta)
+    {
+        const uint32_t time = EventTimeUs();
+        uint8_t frame[7] = {
+            0xA5,
+            static_cast<uint8_t>(type << 6 | index),
+            static_cast<uint8_t>(delta),
+            static_cast<uint8_t>(time & 0xff),
+            static_cast<uint8_t>((time >> 8) & 0xff),
+            static_cast<uint8_t>((time >> 16) & 0xff),
+            0
+        };
+
+        for (int i = 0; i < 6; ++i)
+        {
+            frame[6] ^= frame[i];
+
+            for (int b = 0; b < 8; ++b)
+                frame[6] = frame[6] & 0x80 ? (frame[6] << 1) ^ 0x07 : frame[6] << 1;
+        }
+
+        buffer.insert(buffer.end(), frame, frame + sizeof(frame));
+    }
+
+    // random bytes or a message cut short, always followed by a newline in text mode
+    // random bytes never include the binary sync byte, as CRC-8 cannot reliably catch every fake frame
+    void addGarbage(std::vector<char>& buffer)
+    {
+        if (random() % 2 == 0)
+        {
+            std::vector<char> msg;
+
+            if (binary)
+                addFrame(msg, 0, random() % numEncoders, 1);
+            else
+                addRotation(msg, random() % numEncoders, 1);
+
+            buffer.insert(buffer.end(), msg.begin(), msg.begin() + 1 + random() % (msg.size() - 2));
+        }
+        else
+        {
+            for (long i = 0, size = 1 + random() % 12; i < size; ++i)
+            {
+                const char c = random() % 256;
+                buffer.push_back(c != '\n' && c != static_cast<char>(0xA5) ? c : '?');
+            }
+        }
+
+        if (! binary)
+            buffer.push_back('\n');
+    }
+
+    bool writeAll(const char* data, size_t size)
+    {
+        while (size != 0)
+        {
+            const ssize_t ret = write(masterfd, data, size);
+
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                fprintf(stderr, "failed to write to pseudo-terminal: %s\n", std::strerror(errno));
+                return false;
+            }
+
+            data += ret;
+            size -= ret;
+        }
+
+        return true;
+    }
+
+    static void sleepUntil(const uint64_t timeUs) noexcept
+    {
+        timespec ts;
+        ts.tv_sec = timeUs / 1000000;
+        ts.tv_nsec = (timeUs % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+    }
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+struct Benchmark : EventBridge::Callback {
+    // latency of each received event, from event time to delivery, in microseconds
+    std::vector<uint32_t> latencies;
+    std::vector<int64_t> receivedDeltas;
+    uint64_t receivedPresses = 0;
+    uint64_t receivedReleases = 0;
+    uint64_t receivedLongPresses = 0;
+    uint64_t receivedTapTempos = 0;
+    // time the last message was delivered, long-press timeouts can arrive well after everything was parsed
+    uint64_t lastMessage = 0;
+
+    void eventReceived(EventType, EventState, uint8_t, int32_t, const uint64_t time) override
+    {
+        latencies.push_back(EventTimeUs() - time);
+    }
+
+    void eventsReceived(const Event* const events, const uint32_t count) override
+    {
+        const uint64_t now = EventTimeUs();
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const Event& ev(events[i]);
+            latencies.push_back(now - ev.time);
+
+            if (ev.etype != kEventTypeEncoder || ev.index >= receivedDeltas.size())
+                continue;
+
+            switch (ev.state)
+            {
+            case kEventStateLongPressed:
+                ++receivedLongPresses;
+                continue;
+            case kEventStateTapTempo:
+                ++receivedTapTempos;
+                continue;
+            default:
+                break;
+            }
+
+            // rotations always have a value, also while pressed, button changes never do
+            if (ev.value != 0)
+                receivedDeltas[ev.index] += ev.value;
+            else if (ev.state == kEventStatePressed)
+                ++receivedPresses;
+            else
+                ++receivedReleases;
+
+            lastMessage = now;
+        }
+    }
+};
+
+// amount of mismatched items between @a a and @a b
+static uint64_t mismatch(const int64_t a, const int64_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+// read back everything written to @a log, summing malformed message reports and passing anything else through
+static uint64_t readMalformed(FILE* const log)
+{
+    uint64_t total = 0;
+    char line[256];
+
+    std::rewind(log);
+
+    while (std::fgets(line, sizeof(line), log) != nullptr)
+    {
+        unsigned int count;
+
+        if (std::sscanf(line, "Serial input: %u malformed messages dropped", &count) == 1)
+            total += count;
+        else
+            std::fputs(line, stderr);
+    }
+
+    std::fclose(log);
+    return total;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, const double p)
+{
+    if (sorted.empty())
+        return 0;
+
+    return sorted[std::min<size_t>(sorted.size() * p / 100.0, sorted.size() - 1)];
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    uint32_t seconds = SERIAL_BENCHMARK_DEFAULT_SECONDS;
+    const char* options = "";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            seconds = std::strtoul(argv[++i], nullptr, 10);
+        else
+            options = argv[i];
+    }
+
+    SerialSimulator sim;
+
+    if (! sim.parseOptions(options) || ! sim.open())
+        return 1;
+
+    srandom(sim.seed);
+
+    Benchmark benchmark;
+    benchmark.latencies.reserve(sim.count);
+    benchmark.receivedDeltas.resize(sim.numEncoders);
+
+    EventActuators actuators;
+    actuators.numEncoders = sim.numEncoders;
+    actuators.numFootswitches = 0;
+    actuators.numLEDs = 0;
+
+    EventBridge bridge(&benchmark, actuators);
+
+    if (! bridge.addInput(EventInput::kBackendTypeLibSerialPort, sim.slavePath))
+    {
+        fprintf(stderr, "failed to add serial input '%s': %s\n", sim.slavePath, bridge.last_error.c_str());
+        sim.close();
+        return 1;
+    }
+
+    // collect backend diagnostics while running, so malformed message reports can be counted
+    std::fflush(stderr);
+    const int stderrfd = dup(STDERR_FILENO);
+    FILE* const log = std::tmpfile();
+
+    if (log == nullptr || stderrfd == -1 || dup2(fileno(log), STDERR_FILENO) == -1)
+    {
+        fprintf(stderr, "failed to redirect diagnostics: %s\n", std::strerror(errno));
+        sim.close();
+        return 1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, SerialSimulator::_run, &sim) != 0)
+    {
+        dup2(stderrfd, STDERR_FILENO);
+        fprintf(stderr, "failed to create simulator thread\n");
+        sim.close();
+        return 1;
+    }
+
+    struct pollfd pfd = { bridge.getPollFD(), POLLIN, 0 };
+
+    const uint64_t start = EventTimeUs();
+    const uint64_t end = start + static_cast<uint64_t>(seconds) * 1000000;
+    uint64_t pollTime = 0;
+    uint64_t lastReceived = start;
+
+    for (uint64_t now = start; now < end; now = EventTimeUs())
+    {
+        if (pfd.fd != -1)
+            ::poll(&pfd, 1, 100);
+
+        const size_t received = benchmark.latencies.size();
+
+        const uint64_t t = EventTimeUs();
+        bridge.poll();
+        pollTime += EventTimeUs() - t;
+
+        if (received != benchmark.latencies.size())
+            lastReceived = t;
+
+        if (! sim.done.load(std::memory_order_acquire))
+            continue;
+
+        // everything received, or nothing else arriving
+        if ((benchmark.receivedDeltas == sim.sentDeltas
+             && benchmark.receivedPresses == sim.sentPresses
+             && benchmark.receivedReleases == sim.sentReleases)
+            || t - lastReceived > SERIAL_BENCHMARK_IDLE_TIMEOUT)
+            break;
+    }
+
+    // stop the simulator if the time ran out before it was done
+    sim.stopped.store(true, std::memory_order_relaxed);
+    pthread_join(thread, nullptr);
+
+    std::fflush(stderr);
+    dup2(stderrfd, STDERR_FILENO);
+    close(stderrfd);
+
+    const uint64_t malformed = readMalformed(log);
+
+    const double elapsed = ((benchmark.lastMessage != 0 ? benchmark.lastMessage : EventTimeUs()) - start) / 1000000.0;
+    const size_t received = benchmark.latencies.size();
+
+    int64_t sentDelta = 0, receivedDelta = 0;
+    for (uint8_t i = 0; i < sim.numEncoders; ++i)
+    {
+        sentDelta += sim.sentDeltas[i];
+        receivedDelta += benchmark.receivedDeltas[i];
+    }
+
+    std::vector<uint32_t>& sorted = benchmark.latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("protocol:    %s over %s\n", sim.binary ? "binary" : "text", sim.slavePath);
+    printf("sent:        %llu messages (%llu rotations, %llu presses, %llu releases), %llu garbage, %llu bytes\n",
+           static_cast<unsigned long long>(sim.sentMessages),
+           static_cast<unsigned long long>(sim.sentRotations),
+           static_cast<unsigned long long>(sim.sentPresses),
+           static_cast<unsigned long long>(sim.sentReleases),
+           static_cast<unsigned long long>(sim.sentGarbage),
+           static_cast<unsigned long long>(sim.sentBytes));
+    printf("received:    %zu events, %llu long-presses, %llu tap-tempo\n",
+           received,
+           static_cast<unsigned long long>(benchmark.receivedLongPresses),
+           static_cast<unsigned long long>(benchmark.receivedTapTempos));
+    printf("rotations:   total %lld of %lld (%lld missing)\n",
+           static_cast<long long>(receivedDelta),
+           static_cast<long long>(sentDelta),
+           static_cast<long long>(sentDelta - receivedDelta));
+    printf("buttons:     %llu of %llu presses, %llu of %llu releases\n",
+           static_cast<unsigned long long>(benchmark.receivedPresses),
+           static_cast<unsigned long long>(sim.sentPresses),
+           static_cast<unsigned long long>(benchmark.receivedReleases),
+           static_cast<unsigned long long>(sim.sentReleases));
+    printf("malformed:   %llu dropped by the serial input\n", static_cast<unsigned long long>(malformed));
+    printf("throughput:  %.0f messages/s, %.0f bytes/s over %.3f s\n",
+           sim.sentMessages / elapsed, sim.sentBytes / elapsed, elapsed);
+    printf("cost:        %.1f ns/event in poll()\n", received != 0 ? pollTime * 1000.0 / received : 0.0);
+    printf("latency us:  p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n",
+           percentile(sorted, 50),
+           percentile(sorted, 90),
+           percentile(sorted, 99),
+           percentile(sorted, 99.9),
+           sorted.empty() ? 0 : sorted.back());
+
+    const uint64_t mismatched = mismatch(sentDelta, receivedDelta)
+                              + mismatch(sim.sentPresses, benchmark.receivedPresses)
+                              + mismatch(sim.sentReleases, benchmark.receivedReleases);
+    const uint64_t tolerated = sim.sentGarbage * SERIAL_BENCHMARK_GARBAGE_TOLERANCE / 1000;
+
+    printf("result:      %s, %llu mismatched, %llu tolerated\n",
+           mismatched <= tolerated ? "ok" : "FAILED",
+           static_cast<unsigned long long>(mismatched),
+           static_cast<unsigned long long>(tolerated));
+
+    sim.close();
+    return mismatched <= tolerated ? 0 : 1;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
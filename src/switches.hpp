@@ -0,0 +1,244 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "actuators.hpp"
+#include "events.hpp"
+#include "ringbuffer.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Timing engine for switch-like inputs that only report raw levels, such as GPIOs.
+ * Turns level changes into footswitch events with debounce, long-press and tap-tempo,
+ * following the same semantics as the LibInput backend.
+ *
+ * Debounce is leading-edge: a change is reported right away and further changes of the same line are ignored until
+ * its debounce window ends, at which point the line level is checked again and reported if it differs.
+ *
+ * changed() and flush() are meant for the reactor thread, poll(), clear() and enableTapTempo() for the poll thread.
+ */
+struct SwitchEngine : EventReactor::Handler {
+    SwitchEngine(EventReactor* const reactor_,
+                 EventInput* const input_,
+                 const EventActuators& actuators,
+                 const uint8_t numLines)
+        : reactor(reactor_),
+          input(input_),
+          numEncoders(actuators.numEncoders),
+          table(EventActuators { 0, numLines, 0 }),
+          lines(numLines) {}
+
+    ~SwitchEngine() override
+    {
+        reactor->cancelTimers(this);
+    }
+
+    /**
+     * Set the footswitch index and debounce window of @a line, in microseconds.
+     * Must be called before the line reports any change.
+     */
+    void setLine(const uint8_t line, const uint8_t index, const uint32_t debounceUs) noexcept
+    {
+        lines[line].index = index;
+        lines[line].debounce = debounceUs;
+    }
+
+    /**
+     * Report the initial level of @a line, without debounce or long-press handling.
+     * Meant to be called before the input registers itself on the reactor, as reactor timers are not touched.
+     */
+    void initial(const uint8_t line, const bool level, const uint64_t time)
+    {
+        Line& l = lines[line];
+        l.raw = l.stable = level;
+
+        table.state[line] = level ? kEventStatePressed : kEventStateReleased;
+        queueEvent(line, table.state[line], 0, time);
+    }
+
+    /**
+     * Report the raw level of @a line at @a time, does nothing if the level is the same as last time.
+     * Call flush() after handling a group of changes.
+     */
+    void changed(const uint8_t line, const bool level, const uint64_t time)
+    {
+        handleClearRequest();
+
+        Line& l = lines[line];
+        l.raw = level;
+
+        // within debounce window, level is checked again once it ends
+        if (l.lockoutEnd != 0)
+            return;
+
+        accept(line, time);
+    }
+
+    /**
+     * Signal the owner input about new events, if there are any.
+     */
+    void flush()
+    {
+        if (notifyPending)
+        {
+            notifyPending = false;
+            input->notify();
+        }
+    }
+
+    void poll(EventInput::Callback* const cb)
+    {
+        Event batch[32];
+
+        for (uint32_t count; (count = events.pop(batch, sizeof(batch)/sizeof(batch[0]))) != 0;)
+            cb->events(batch, count);
+
+        const uint32_t overflowCount = events.getOverflowCount();
+
+        if (lastOverflowCount != overflowCount)
+        {
+            fprintf(stderr, "Switch event queue overflow, %u events dropped\n", overflowCount - lastOverflowCount);
+            lastOverflowCount = overflowCount;
+        }
+    }
+
+    void clear()
+    {
+        // reactor thread resets its own state, we only drop what is already queued
+        clearRequested.store(true, std::memory_order_release);
+        events.clear();
+    }
+
+    /**
+     * Enable tap-tempo for actuator @a slot, as given by EventBridge (footswitches after encoders).
+     */
+    void enableTapTempo(const uint16_t slot, const bool enable)
+    {
+        if (slot < numEncoders)
+            return;
+
+        for (uint8_t i = 0; i < lines.size(); ++i)
+        {
+            if (lines[i].index != slot - numEncoders)
+                continue;
+
+            table.tapEnabled[i].store(enable, std::memory_order_relaxed);
+            table.tapReset[i].store(true, std::memory_order_release);
+        }
+    }
+
+    void fdReady(int, uint32_t) override {}
+
+    // timer ids below the line count are long-press deadlines for that line,
+    // above it they are the end of a debounce window for line (id - count)
+    void timerExpired(const uint32_t id, const uint64_t deadline) override
+    {
+        handleClearRequest();
+
+        if (id >= lines.size())
+        {
+            const uint8_t line = id - lines.size();
+            lines[line].lockoutEnd = 0;
+
+            // level changed during the window, report it now
+            if (lines[line].raw != lines[line].stable)
+                accept(line, deadline);
+        }
+        else if (table.state[id] == kEventStatePressed)
+        {
+            table.pressTime[id] = 0;
+            table.state[id] = kEventStateLongPressed;
+            queueEvent(id, kEventStateLongPressed, 0, deadline);
+        }
+
+        flush();
+    }
+
+private:
+    struct Line {
+        // footswitch index, lines not setup are never matched
+        uint8_t index = UINT8_MAX;
+        // debounce window in microseconds
+        uint32_t debounce = 0;
+        // last reported level
+        bool stable = false;
+        // last raw level
+        bool raw = false;
+        // end of the current debounce window, 0 if none is open
+        uint64_t lockoutEnd = 0;
+    };
+
+    EventReactor* const reactor;
+    EventInput* const input;
+    const uint8_t numEncoders;
+
+    // live state, only accessed by the reactor thread except for tap-tempo flags
+    ActuatorTable table;
+    std::vector<Line> lines;
+
+    RingBuffer<Event, EVENT_BRIDGE_QUEUE_SIZE> events;
+    uint32_t lastOverflowCount = 0;
+
+    // request from poll thread for the reactor thread to reset its state
+    std::atomic<bool> clearRequested { false };
+
+    // whether new events were queued since last notify, only used by the reactor thread
+    bool notifyPending = false;
+
+    void handleClearRequest()
+    {
+        if (! clearRequested.exchange(false, std::memory_order_acquire))
+            return;
+
+        // keep levels, so the next change is still compared against what was reported
+        reactor->cancelTimers(this);
+        table.reset();
+
+        for (Line& line : lines)
+            line.lockoutEnd = 0;
+    }
+
+    void accept(const uint8_t line, const uint64_t time)
+    {
+        Line& l = lines[line];
+
+        if (l.raw == l.stable)
+            return;
+
+        l.stable = l.raw;
+
+        if (l.debounce != 0)
+        {
+            l.lockoutEnd = time + l.debounce;
+            reactor->armTimer(this, lines.size() + line, l.lockoutEnd);
+        }
+
+        if (l.stable)
+        {
+            table.pressTime[line] = time;
+            table.state[line] = kEventStatePressed;
+            reactor->armTimer(this, line, time + EVENT_BRIDGE_LONG_PRESS_TIME * 1000);
+            queueEvent(line, kEventStatePressed, 0, time);
+
+            if (table.tapEnabled[line].load(std::memory_order_relaxed) && table.updateTapTempo(line, time))
+                queueEvent(line, kEventStateTapTempo, table.tapValue[line], time);
+        }
+        else
+        {
+            table.pressTime[line] = 0;
+            table.state[line] = kEventStateReleased;
+            reactor->cancelTimer(this, line);
+            queueEvent(line, kEventStateReleased, 0, time);
+        }
+    }
+
+    void queueEvent(const uint8_t line, const EventState state, const int32_t value, const uint64_t time)
+    {
+        events.push({ kEventTypeFootswitch, state, lines[line].index, value, time });
+        notifyPending = true;
+    }
+};
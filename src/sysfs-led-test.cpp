@@ -0,0 +1,164 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+// Sysfs LED output tests, using a fake sysfs tree made of regular files in a temporary directory.
+// Usage: event-bridge-sysfs-led-test
+// Checks multicolor and separate LEDs, and the fallback when a multicolor LED reports no brightness range.
+// Exits with a non-zero status if any check fails.
+
+#include "events.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static uint32_t failures = 0;
+
+static void check(const bool ok, const char* const what)
+{
+    if (! ok)
+    {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+static void writeFile(const std::string& path, const char* const contents)
+{
+    if (FILE* const file = std::fopen(path.c_str(), "w"))
+    {
+        std::fputs(contents, file);
+        std::fclose(file);
+    }
+}
+
+// read what was written to @a path and empty it, as LED values are written in place without truncating
+static std::string consumeFile(const std::string& path)
+{
+    std::string contents;
+
+    if (FILE* const file = std::fopen(path.c_str(), "r+"))
+    {
+        char buf[64];
+        size_t len;
+
+        while ((len = std::fread(buf, 1, sizeof(buf), file)) != 0)
+            contents.append(buf, len);
+
+        check(ftruncate(fileno(file), 0) == 0, "fake sysfs files can be emptied");
+        std::fclose(file);
+    }
+
+    return contents;
+}
+
+// create a fake LED directory with the given max_brightness and empty value files
+static std::string makeLED(const std::string& path, const char* const maxBrightness)
+{
+    mkdir(path.c_str(), 0755);
+    writeFile(path + "/max_brightness", maxBrightness);
+    writeFile(path + "/brightness", "");
+    return path;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void testMultiLED(const std::string& root)
+{
+    const std::string led = makeLED(root + "/multi", "255\n");
+    writeFile(led + "/multi_index", "green red blue\n");
+    writeFile(led + "/multi_intensity", "");
+
+    EventOutput* const output = EventOutput::createNew(EventOutput::kBackendTypeSysfsLED, led.c_str());
+    check(output != nullptr, "multicolor LED is created");
+    if (output == nullptr)
+        return;
+
+    check(consumeFile(led + "/brightness") == "255", "multicolor LED brightness is kept at maximum");
+    check(consumeFile(led + "/multi_intensity") == "0 0 0", "multicolor LED starts off");
+
+    output->event(0xff8000);
+    check(consumeFile(led + "/multi_intensity") == "128 255 0", "multicolor LED follows multi_index order");
+
+    output->event(0xff8000);
+    check(consumeFile(led + "/multi_intensity").empty(), "multicolor LED skips unchanged values");
+
+    delete output;
+}
+
+static void testSeparateLEDs(const std::string& root)
+{
+    const std::string id = root + "/separate";
+    const std::string red = makeLED(id + ":red", "100\n");
+    const std::string green = makeLED(id + ":green", "100\n");
+    const std::string blue = makeLED(id + ":blue", "100\n");
+
+    EventOutput* const output = EventOutput::createNew(EventOutput::kBackendTypeSysfsLED, id.c_str());
+    check(output != nullptr, "separate LEDs are created");
+    if (output == nullptr)
+        return;
+
+    check(consumeFile(red + "/brightness") == "0", "separate red LED starts off");
+    check(consumeFile(green + "/brightness") == "0", "separate green LED starts off");
+    check(consumeFile(blue + "/brightness") == "0", "separate blue LED starts off");
+
+    output->event(0x00ff00);
+    check(consumeFile(red + "/brightness").empty(), "unchanged separate LED is not written");
+    check(consumeFile(green + "/brightness") == "100", "separate LED is scaled to its max_brightness");
+    check(consumeFile(blue + "/brightness").empty(), "unchanged separate LED is not written");
+
+    delete output;
+}
+
+static void testMultiLEDWithoutRange(const std::string& root)
+{
+    const std::string led = makeLED(root + "/norange", "0\n");
+    writeFile(led + "/multi_index", "red green blue\n");
+    writeFile(led + "/multi_intensity", "");
+
+    EventOutput* const output = EventOutput::createNew(EventOutput::kBackendTypeSysfsLED, led.c_str());
+    if (output != nullptr)
+        output->event(0xffffff);
+
+    check(consumeFile(led + "/brightness").empty(), "multicolor LED without range does not write brightness");
+    check(consumeFile(led + "/multi_intensity").empty(), "multicolor LED without range is not used");
+
+    delete output;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+int main()
+{
+    char root[] = "/tmp/event-bridge-sysfs-led-test.XXXXXX";
+
+    if (mkdtemp(root) == nullptr)
+    {
+        fprintf(stderr, "cannot create temporary directory\n");
+        return 1;
+    }
+
+    testMultiLED(root);
+    testSeparateLEDs(root);
+    testMultiLEDWithoutRange(root);
+
+    const std::string cleanup = std::string("rm -rf '") + root + "'";
+    if (std::system(cleanup.c_str()) != 0)
+        fprintf(stderr, "cannot remove %s\n", root);
+
+    if (failures != 0)
+    {
+        fprintf(stderr, "%u checks failed\n", failures);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
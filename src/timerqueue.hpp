@@ -0,0 +1,175 @@
+// SPDX-FileCopyrightText: 2024-2025 Filipe Coelho <falktx@darkglass.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "events.hpp"
+
+#include <vector>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/**
+ * Small queue of armed deadlines, backed by a single timerfd.
+ * The timerfd is always programmed for the earliest deadline, so only armed timers cost anything.
+ * Not thread-safe, all calls must happen from the thread waiting on getFD().
+ */
+struct TimerQueue {
+    TimerQueue()
+    {
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        timers.reserve(32);
+    }
+
+    ~TimerQueue()
+    {
+        if (fd != -1)
+            close(fd);
+    }
+
+    /**
+     * Get the timerfd, becomes readable once the earliest deadline is reached and process() needs to be called.
+     */
+    int getFD() const noexcept
+    {
+        return fd;
+    }
+
+    /**
+     * Arm (or re-arm) timer @a id for @a handler, expiring at @a deadline in monotonic microseconds.
+     * @see EventTimeUs()
+     */
+    void arm(EventReactor::Handler* const handler, const uint32_t id, const uint64_t deadline)
+    {
+        for (Timer& timer : timers)
+        {
+            if (timer.handler == handler && timer.id == id)
+            {
+                timer.deadline = deadline;
+                reprogram();
+                return;
+            }
+        }
+
+        timers.push_back({ deadline, handler, id });
+        reprogram();
+    }
+
+    /**
+     * Cancel timer @a id for @a handler, does nothing if not armed.
+     */
+    void cancel(EventReactor::Handler* const handler, const uint32_t id)
+    {
+        for (size_t i = 0; i < timers.size(); ++i)
+        {
+            if (timers[i].handler == handler && timers[i].id == id)
+            {
+                timers[i] = timers.back();
+                timers.pop_back();
+                reprogram();
+                return;
+            }
+        }
+    }
+
+    /**
+     * Cancel all timers for @a handler.
+     */
+    void cancelAll(EventReactor::Handler* const handler)
+    {
+        for (size_t i = 0; i < timers.size();)
+        {
+            if (timers[i].handler == handler)
+            {
+                timers[i] = timers.back();
+                timers.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        reprogram();
+    }
+
+    /**
+     * Fire all expired timers, to be called when getFD() is readable.
+     * Handlers are allowed to arm and cancel timers from within their callback.
+     */
+    void process()
+    {
+        uint64_t expirations;
+        read(fd, &expirations, sizeof(expirations));
+
+        // timerfd has expired, needs to be programmed again even if the earliest deadline stays the same
+        programmed = 0;
+
+        const uint64_t now = EventTimeUs();
+
+        for (size_t i = 0; i < timers.size();)
+        {
+            if (timers[i].deadline > now)
+            {
+                ++i;
+                continue;
+            }
+
+            const Timer timer = timers[i];
+            timers[i] = timers.back();
+            timers.pop_back();
+
+            timer.handler->timerExpired(timer.id, timer.deadline);
+
+            // handler might have changed the list, start over
+            i = 0;
+        }
+
+        reprogram();
+    }
+
+private:
+    struct Timer {
+        uint64_t deadline;
+        EventReactor::Handler* handler;
+        uint32_t id;
+    };
+    std::vector<Timer> timers;
+    int fd = -1;
+    // deadline currently programmed into the timerfd, 0 means disarmed
+    uint64_t programmed = 0;
+
+    void reprogram()
+    {
+        if (fd == -1)
+            return;
+
+        uint64_t earliest = 0;
+
+        if (! timers.empty())
+        {
+            earliest = timers[0].deadline;
+
+            for (size_t i = 1; i < timers.size(); ++i)
+            {
+                if (earliest > timers[i].deadline)
+                    earliest = timers[i].deadline;
+            }
+
+            // a zero value disarms the timer, so make sure an already expired deadline still fires
+            if (earliest == 0)
+                earliest = 1;
+        }
+
+        if (programmed == earliest)
+            return;
+
+        programmed = earliest;
+
+        struct itimerspec its = {};
+        its.it_value.tv_sec = earliest / 1000000;
+        its.it_value.tv_nsec = (earliest % 1000000) * 1000;
+        timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    }
+};
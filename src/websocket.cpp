@@ -64,6 +64,12 @@ struct WebSocketServer::Impl : QObject
         return true;
     }
 
+    void sendMessage(const QString& message)
+    {
+        for (QWebSocket* conn : wsConns)
+            conn->sendTextMessage(message);
+    }
+
     // ----------------------------------------------------------------------------------------------------------------
     // server slots
 
@@ -152,4 +158,9 @@ bool WebSocketServer::listen(const uint16_t port)
     return impl->listen(port);
 }
 
+void WebSocketServer::sendMessage(const QString& message)
+{
+    impl->sendMessage(message);
+}
+
 // --------------------------------------------------------------------------------------------------------------------
@@ -26,6 +26,9 @@ struct WebSocketServer
 
     bool listen(uint16_t port);
 
+    /** send a text message to all connected clients */
+    void sendMessage(const QString& message);
+
     WebSocketServer(Callbacks* callbacks);
     ~WebSocketServer();
 